@@ -0,0 +1,145 @@
+#ifndef LinkStorage_h
+#define LinkStorage_h
+
+// Link parameters agreed by binding and where they are kept between power cycles. Every sketch folder carries an
+// identical copy of this file
+
+#include <Arduino.h>
+#include <stdio.h>
+#if defined(ESP32)
+  #include <Preferences.h>
+#endif
+
+#define LINK_VERSION 1
+#define LINK_ORTHOGONAL 0x01         // Hop with GenerateOrthogonalChannels instead of the seeded shuffle
+#define LINK_SAVE_FRAME_DIVISOR 2000 // StoreFrameTime only rewrites once the frame time moved by 1/2000 of itself, 0.05%
+#define LINK_SAVE_MIN_MILLIS 600000  // and no more often than this, flash wear
+
+struct __attribute__((packed)) LinkParameters
+{
+  uint8_t version = LINK_VERSION;
+  uint8_t masterAddress[5] = {};
+  uint8_t slaveAddress[5] = {};
+  uint32_t hopSeed = 0;
+  uint16_t frameRate = 0;
+  uint8_t channelsToHop = 40;
+  uint8_t framesPerHop = 2;
+  uint8_t lowerBound = 76;       // Channel range handed to GenerateChannels, set before binding to change it
+  uint8_t upperBound = 124;
+  uint8_t flags = 0;
+  uint32_t microsPerFrame = 0;   // Slave only. Frame time it tracked while locked, 0 until stored
+  uint16_t checksum = 0;         // Fletcher-16 over everything above
+};
+
+inline uint16_t LinkChecksum(const LinkParameters& link)
+{
+  const uint8_t* bytes = (const uint8_t*)&link;
+  uint16_t sumA = 0;
+  uint16_t sumB = 0;
+  for(size_t i = 0; i < sizeof(LinkParameters) - sizeof(link.checksum); i++)
+  {
+    sumA = (sumA + bytes[i]) % 255;
+    sumB = (sumB + sumA) % 255;
+  }
+  return (sumB << 8) | sumA;
+}
+
+inline void SealLink(LinkParameters& link)
+{
+  link.version = LINK_VERSION;
+  link.checksum = LinkChecksum(link);
+}
+
+inline bool IsLinkValid(const LinkParameters& link)
+{
+  return link.version == LINK_VERSION && link.frameRate != 0 && link.checksum == LinkChecksum(link);
+}
+
+// Somewhere to keep one LinkParameters. Load returns false when nothing valid is stored
+class LinkStorage
+{
+public:
+  virtual ~LinkStorage() {}
+  virtual bool Load(LinkParameters& link) = 0;
+  virtual bool Save(const LinkParameters& link) = 0;
+  virtual void Clear() = 0;
+};
+
+#if defined(ESP32)
+// ESP32 NVS through the Preferences library. Writing stalls both cores while the flash is busy, so don't save
+// from the radio task or while a frame is due
+class PreferencesLinkStorage : public LinkStorage
+{
+private:
+  const char* name;
+
+public:
+  PreferencesLinkStorage(const char* name = "nrffhss") : name(name) {}
+
+  bool Load(LinkParameters& link) override
+  {
+    Preferences preferences;
+    if(!preferences.begin(name, true)) { return false; }
+    LinkParameters stored;
+    size_t length = preferences.getBytes("link", &stored, sizeof(stored));
+    preferences.end();
+    if(length != sizeof(stored) || !IsLinkValid(stored)) { return false; }
+    link = stored;
+    return true;
+  }
+
+  bool Save(const LinkParameters& link) override
+  {
+    Preferences preferences;
+    if(!preferences.begin(name, false)) { return false; }
+    size_t length = preferences.putBytes("link", &link, sizeof(link));
+    preferences.end();
+    return length == sizeof(link);
+  }
+
+  void Clear() override
+  {
+    Preferences preferences;
+    if(!preferences.begin(name, false)) { return; }
+    preferences.remove("link");
+    preferences.end();
+  }
+};
+#endif
+
+// Plain file, for a mounted SPIFFS/LittleFS path on the board or a host build
+class FileLinkStorage : public LinkStorage
+{
+private:
+  const char* path;
+
+public:
+  FileLinkStorage(const char* path) : path(path) {}
+
+  bool Load(LinkParameters& link) override
+  {
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr) { return false; }
+    LinkParameters stored;
+    size_t length = fread(&stored, 1, sizeof(stored), file);
+    fclose(file);
+    if(length != sizeof(stored) || !IsLinkValid(stored)) { return false; }
+    link = stored;
+    return true;
+  }
+
+  bool Save(const LinkParameters& link) override
+  {
+    FILE* file = fopen(path, "wb");
+    if(file == nullptr) { return false; }
+    size_t length = fwrite(&link, 1, sizeof(link), file);
+    return (fclose(file) == 0) && length == sizeof(link);
+  }
+
+  void Clear() override
+  {
+    remove(path);
+  }
+};
+
+#endif
@@ -15,15 +15,15 @@
 #define PACKET_SIZE 32                // Max 32 Bytes. Must match the slave packet size. How many bytes you are maximum packing into each packet. Useable size is 1 less than this as first byte is PacketID and Hopping information
 #define NUMBER_OF_SENDPACKETS 2       // Max of 3 Packets. How many packets per frame the Master will send. The Slave needs to have the same amount of receive packets
 #define NUMBER_OF_RECEIVE_PACKETS 2   // Max of 3 Packets. How many packets per frame the Master will receive. The Slave needs to have the same amount of send packets
-#define FRAME_RATE 50                 // Locked frame rate of the microcontroller. Must match the Slaves Framerate
+#define FRAME_RATE 50                 // Locked frame rate of the microcontroller, 10 to 500. Must match the Slaves Framerate
 
-RadioMaster radio;
+StaticRadioMaster<PACKET_SIZE, NUMBER_OF_SENDPACKETS, NUMBER_OF_RECEIVE_PACKETS> radio;  // Buffers are held inside the object, no heap use
 int16_t slaveRecPerSecond;
 int16_t lastSlaveRecPerSecond = 0;
 int16_t lastNumber16Bit = 0;
 uint8_t lastNumberU8Bit = 0;
 float lastNumberFloat = 0.0;
-uint32_t lastNumberU32Bit = 0;
+uint32_t lastRoundTripMicros = 0;
 
 void setup() {
     Serial.begin(115200);
@@ -34,21 +34,53 @@ void setup() {
     // Generate the channels with lower bound, upper bound, and a seed value
     radio.GenerateChannels(76, 124, 12345);
 
-    // Init must be called first with the following defined Parameters
-    radio.Init(&SPI, CE_PIN, CS_PIN, POWER_LEVEL, PACKET_SIZE, NUMBER_OF_SENDPACKETS, NUMBER_OF_RECEIVE_PACKETS, FRAME_RATE);
-
-    // Create the Master task on Core 1, Wifi/BT runs on Core 0
-    xTaskCreatePinnedToCore(masterTask, "MasterTask", 4096, NULL, 1, NULL, 1);
+    // Init must be called first with the following defined Parameters. Packet size and counts come from the template above
+    // A plain RadioMaster takes them at runtime instead: Init(&SPI, CE_PIN, CS_PIN, POWER_LEVEL, PACKET_SIZE, NUMBER_OF_SENDPACKETS, NUMBER_OF_RECEIVE_PACKETS, FRAME_RATE)
+    radio.Init(&SPI, CE_PIN, CS_PIN, POWER_LEVEL, FRAME_RATE);
+
+    // Optional. Bind instead of using the fixed addresses and seed above. The first power on offers random addresses
+    // and a random seed until a Slave in bind mode accepts, after that the link is loaded from flash. storage.Clear() to bind again
+    // PreferencesLinkStorage storage;
+    // LinkParameters link;
+    // if (!storage.Load(link)) {
+    //     while (!radio.Bind(link, 10000)) {}
+    //     storage.Save(link);
+    // }
+    // radio.UseLink(link);
+    // radio.Init(&SPI, CE_PIN, CS_PIN, POWER_LEVEL, link.frameRate);
+
+    // Optional. Measures how long data takes from AddNextPacketValue on the Slave to arriving here. Must also be enabled on the Slave
+    // radio.EnableLatencyStats();
+
+    // Optional. Counts lost and repeated packets exactly and drops late copies. Must also be enabled on the Slave
+    // radio.EnableSequenceNumbers();
+
+    // Optional. Steps the PA level between 0 and POWER_LEVEL to keep 95% of our packets reaching the Slave. Must also be enabled on the Slave
+    // radio.EnablePowerControl(95);
+
+    // The radio runs its own high priority task on Core 1, Wifi/BT runs on Core 0
+    // Received packets are handed to ProcessReceived and AddSendData fills the packets right before they are sent
+    radio.OnReceive(ProcessReceived);
+    radio.OnFillFrame(AddSendData);
+
+    // Printing is kept out of the radio task. The status task is woken after every frame
+    TaskHandle_t statusTask;
+    xTaskCreatePinnedToCore(masterStatusTask, "MasterStatus", 4096, NULL, 1, &statusTask, 1);
+    radio.SetNotifyTask(statusTask);
+    radio.StartTask(1);
 }
 
-void masterTask(void *pvParameters) {
-    Serial.println("Master Task On: " + String(xPortGetCoreID()) + " | " + String(ESP.getCpuFreqMHz()) + "MHz");
+void masterStatusTask(void *pvParameters) {
+    Serial.println("Master Status Task On: " + String(xPortGetCoreID()) + " | " + String(ESP.getCpuFreqMHz()) + "MHz");
     while (1) {
-        radio.WaitAndSend();
-        radio.Receive();
-        
-        ProcessReceived();
-        AddSendData();
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // Wait for the radio task to finish a frame
+
+#ifdef RADIO_TRACE
+        // Send 't' to dump the frame trace as binary, decode it with tools/decode_trace.py
+        if (Serial.available() && Serial.read() == 't') {
+            RadioTraceDump(Serial);
+        }
+#endif
 
         if (radio.IsSecondTick()) {
             // Print out received data in a human-readable format
@@ -57,20 +89,30 @@ void masterTask(void *pvParameters) {
             dataString += "Received 16-bit value: " + String(lastNumber16Bit) + "\n";
             dataString += "Received 8-bit value: " + String(lastNumberU8Bit) + "\n";
             dataString += "Received Float: " + String(lastNumberFloat, 2) + "\n";
-            dataString += "Received 32-bit value: " + String(lastNumberU32Bit) + "\n";
+            dataString += "Echoed Round Trip/Reply Read us: " + String(lastRoundTripMicros) + " | " + String(radio.GetReplyMicros()) + "\n";
+            dataString += "Packet1 Latency p50/p99/max us: " + String(radio.GetLatencyPercentileMicros(PACKET1, 50)) + " | " + String(radio.GetLatencyPercentileMicros(PACKET1, 99)) + " | " + String(radio.GetMaxLatencyMicros(PACKET1)) + "\n";
+            dataString += "Packet1 Lost/Dup/Longest Gap: " + String(radio.GetSequenceStats(PACKET1).lost) + " | " + String(radio.GetSequenceStats(PACKET1).duplicates) + " | " + String(radio.GetSequenceStats(PACKET1).longestGap) + "\n";
+            dataString += "PA Level/Peer Delivery %/Changes: " + String(radio.GetPowerLevel()) + " | " + String(radio.GetPeerDeliveryPercent()) + " | " + String(radio.GetPowerChanges()) + "\n";
+#ifdef RADIO_PROFILE
+            // Average and worst case time of each phase of the radio task, the wait is the headroom left in the frame
+            const char *phaseNames[PROFILE_PHASES] = {"Wait", "Fill", "Send", "Hop", "Receive", "Clear"};
+            for (uint8_t phase = 0; phase < PROFILE_PHASES; phase++) {
+                ProfileStats stats = radio.GetProfile(phase);
+                dataString += String(phaseNames[phase]) + " avg/max us: " + String(stats.AverageCycles() / RadioCyclesPerMicro()) + " | " + String(stats.maxCycles / RadioCyclesPerMicro()) + "\n";
+            }
+            radio.ResetProfile();
+#endif
             dataString += "-----------------------------\n";
 
             // Print the entire string at once
             Serial.print(dataString);
 
         }
-
-        vTaskDelay(1);  // Yield to allow other tasks to run
     }
 }
 
-// Functions Below to show how to add and retrieve data from each packet
-void AddSendData() {
+// Functions Below to show how to add and retrieve data from each packet. Both run on the radio task so keep them short
+void AddSendData(void *context) {
     // Data can be sent using PACKET1, PACKET2, or PACKET3
     // The number of sent and received packets in use per frame is set as one of the definitions and passed into the Init Function
     // Data is added sequentially into each packet. The amount of data we can add into the packet is 1 less than Define PACKET_SIZE which is passed into the Init Function
@@ -88,20 +130,20 @@ void AddSendData() {
     radio.AddNextPacketValue(PACKET1, value3);
 }
 
-void ProcessReceived() {
-    // Must call IsNewPacket before processing
+void ProcessReceived(uint8_t packetId, void *context) {
+    // Called once for every packet that arrived this frame
     // When retrieving the data from the Packet, we must do it in the same order as it was added on the slave
     // On receiving, the template also Requires a typecast to the type we are retrieving eg <int16_t>
 
-    if (radio.IsNewPacket(PACKET1)) {  // Call to see if there's new values for Packet1
+    if (packetId == PACKET1) {
         lastSlaveRecPerSecond = radio.GetNextPacketValue<int16_t>(PACKET1);
         lastNumber16Bit = radio.GetNextPacketValue<int16_t>(PACKET1);
         lastNumberU8Bit = radio.GetNextPacketValue<uint8_t>(PACKET1);  // Corrected to uint8_t
     }
 
-    if (radio.IsNewPacket(PACKET2)) {  // Call to see if there's new values for Packet2
+    if (packetId == PACKET2) {
         lastNumberFloat = radio.GetNextPacketValue<float>(PACKET2);
-        lastNumberU32Bit = radio.GetNextPacketValue<uint32_t>(PACKET2);
+        lastRoundTripMicros = micros() - radio.GetNextPacketValue<uint32_t>(PACKET2);  // The Slave echoes the micros() we sent this frame
     }
 }
 
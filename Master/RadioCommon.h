@@ -0,0 +1,754 @@
+#ifndef RadioCommon_h
+#define RadioCommon_h
+
+// Helpers shared by RadioMaster and RadioSlave. Every sketch folder carries an identical copy of this file
+
+#include <Arduino.h>
+#include <RF24.h>
+#include "LinkStorage.h"
+
+//#define RADIO_TRACE                // Uncomment to record per frame events into the trace ring, dump with RadioTraceDump
+//#define RADIO_PROFILE              // Uncomment to time each phase of WaitAndSend and Receive, read with GetProfile
+
+#define RADIO_TX_SETTLE_MICROS 130   // Standby to TX PLL settling before the first bit goes out
+#define RADIO_SPI_LOAD_MICROS 40     // Clocking a full payload into the TX FIFO
+#define RADIO_RX_FIFO_DEPTH 3        // Payloads the NRF24 can hold, a drain never needs more reads than this
+#define RADIO_CS_DELAY_MICROS 1      // RF24 waits this long on every CS edge, 5 by default for CSN pins charged through an RC
+#define RADIO_REPLY_GUARD_MICROS 100 // Margin between the Master being back in RX and the Slave's reply going out
+#define RADIO_TICK_MICROS ((int32_t)(portTICK_PERIOD_MS * 1000))
+#define RADIO_MIN_FRAME_RATE 10
+#define RADIO_MAX_FRAME_RATE 500     // Reachable with 2Mbps and short payloads, Init lowers it if a frame can't fit the exchange
+
+#define LOWPOWER_DEFAULT_GUARD_MICROS 200    // Slave starts listening this long before the Master's burst is due
+#define LOWPOWER_LIGHT_SLEEP_MIN_MICROS 3000 // Shorter waits for the listen window are done awake
+#define LOWPOWER_WAKE_MICROS 1000            // Light sleep ends this early, waking up and the sleep clock's error
+
+#define DIVERSITY_RADIOS 2
+#define DIVERSITY_HYSTERESIS 2       // Frames out of the last 32 the other radio must be ahead by before TX moves to it
+
+#define BIND_CHANNEL 125             // Hop tables leave it out, apart from entry 0 of MakeHopTable tables
+#define BIND_ADDRESS "NRFBD"
+#define BIND_PAYLOAD_SIZE 32
+#define BIND_OFFER 0xB1              // Master's offer, followed by its LinkParameters
+#define BIND_ACCEPT 0xB2             // Slave's answer, followed by the checksum of the offer it took
+#define BIND_REPLY_MICROS 5000       // Master listens this long for an accept after each offer
+#define BIND_LINGER_MILLIS 500       // Slave keeps answering repeated offers in case its accept was missed
+
+#define TIMESYNC_MASTER_BYTES 10     // Master's PACKET1 carries its micros() at send time, then the Slave's offset and uncertainty it measured
+#define TIMESYNC_SLAVE_BYTES 12      // Slave's PACKET1 echoes that send time, with its IRQ time stamp for it and how long it held it before replying
+#define TIMESYNC_INVALID 0xFFFF
+#define TIMESYNC_NO_SAMPLE 0xFFFFFFFF  // Sent in place of the hold time before the Slave has heard the Master's PACKET1
+#define TIMESYNC_ROUND_TRIP_SLACK 20   // us over the shortest recent round trip a sample may take and still move the offset
+
+#define LATENCY_BUCKETS 64
+#define LATENCY_NO_DATA 0x7FFF   // Sent in place of an age when nothing was added to the packet
+#define LATENCY_AGE_SHIFT 4      // Packet ages travel in 16 microsecond units
+
+#define SEQUENCE_WINDOW 128      // Sequence numbers less than this far ahead are new, the rest are late copies
+
+#define POWER_REPORT_BYTES 3            // Both sides' PACKET1 carry a report number, delivery percent and strong signal percent
+#define POWER_WINDOW_FRAMES 32          // Frames per receive quality report
+#define POWER_DEFAULT_TARGET 95         // Delivery percent to hold
+#define POWER_STRONG_PERCENT 90         // Packets above the RPD threshold (-64dBm) before a lower level is tried
+#define POWER_STEP_DOWN_WINDOWS 4       // Strong reports in a row before stepping down a level
+#define POWER_PROBE_WINDOWS 16          // Reports in a row with nothing lost before trying a level down anyway
+#define POWER_PROBE_MAX_WINDOWS 128     // Failed tries double the wait up to this
+#define POWER_SETTLE_WINDOWS 2          // Reports skipped after a change, they were partly measured at the old level
+#define POWER_REPORT_TIMEOUT_WINDOWS 4  // Windows without a report from the peer before going back to full power
+
+static_assert(1 + sizeof(LinkParameters) <= BIND_PAYLOAD_SIZE, "LinkParameters must fit a bind packet");
+
+#ifndef IRAM_ATTR
+  #define IRAM_ATTR  //Interrupt handlers only need placing in IRAM on the ESP32
+#endif
+
+// Hardware random number generator on the ESP32, Arduino's random() elsewhere
+inline uint32_t RadioRandom()
+{
+#if defined(ESP32)
+  return esp_random();
+#else
+  return ((uint32_t)random(0x10000) << 16) | (uint32_t)random(0x10000);
+#endif
+}
+
+// Every frame's control transactions pay RF24's safety delays. stopListening waits txDelay for an auto ack to
+// finish, but auto ack is off on both sides, and CS is driven straight from a pin. Call after setDataRate, it resets txDelay
+inline void TrimRadioDelays(RF24& target)
+{
+  target.txDelay = 0;
+  target.csDelay = RADIO_CS_DELAY_MICROS;
+}
+
+// Random address byte for binding. Runs of alternating bits look like the preamble and all 0 or 1 bytes are
+// easily matched by noise, so those are redrawn
+inline uint8_t RandomAddressByte()
+{
+  uint8_t value;
+  do
+  {
+    value = RadioRandom();
+  } while(value == 0x00 || value == 0x55 || value == 0xAA || value == 0xFF);
+  return value;
+}
+
+// Time on air for one payload with Enhanced ShockBurst framing: preamble, address, 9 bit control field, payload and CRC
+inline uint32_t PacketAirtimeMicros(uint8_t payloadSize, rf24_datarate_e dataRate, uint8_t addressWidth = 5)
+{
+  uint32_t bits = (1 + addressWidth + payloadSize + 2) * 8 + 9;
+  if(dataRate == RF24_2MBPS) { return (bits + 1) / 2; }
+  if(dataRate == RF24_250KBPS) { return bits * 4; }
+  return bits;
+}
+
+// Spacing of the Master's packets within its burst, each one settles and goes out straight after the last
+inline uint32_t BurstPacketSlotMicros(uint8_t payloadSize, rf24_datarate_e dataRate)
+{
+  return RADIO_TX_SETTLE_MICROS + PacketAirtimeMicros(payloadSize, dataRate);
+}
+
+// The Slave replies as soon as the Master's burst is over rather than at a fixed point in the frame.
+// Measured from the end of the Master's first packet (the Slave's IRQ): the rest of the Master's burst
+// back to back, the Master's hop and RX settling, then the guard
+inline uint32_t ReplyDelayMicros(uint8_t payloadSize, uint8_t masterPackets, rf24_datarate_e dataRate)
+{
+  uint32_t packetSlot = BurstPacketSlotMicros(payloadSize, dataRate);
+  uint32_t burstRemainder = (masterPackets > 1) ? (masterPackets - 1) * packetSlot : 0;
+  return burstRemainder + RADIO_SPI_LOAD_MICROS + RADIO_TX_SETTLE_MICROS + RADIO_REPLY_GUARD_MICROS;
+}
+
+// Slave frame start until its whole reply has landed at the Master: reading the Master's burst out so the fill
+// callback can answer it, a hop, then loading and sending each packet
+inline uint32_t ReplyBurstMicros(uint8_t payloadSize, uint8_t masterPackets, uint8_t slavePackets, rf24_datarate_e dataRate)
+{
+  uint32_t packetSlot = RADIO_SPI_LOAD_MICROS + RADIO_TX_SETTLE_MICROS + PacketAirtimeMicros(payloadSize, dataRate);
+  return masterPackets * RADIO_SPI_LOAD_MICROS + RADIO_SPI_LOAD_MICROS + slavePackets * packetSlot;
+}
+
+// Shortest frame that still fits the Master's burst, the Slave's reply and a guard before the next frame.
+// Both sides clamp their frame rate with it so they always agree
+inline uint32_t MinFrameMicros(uint8_t payloadSize, uint8_t masterPackets, uint8_t slavePackets, rf24_datarate_e dataRate)
+{
+  uint32_t firstPacket = RADIO_SPI_LOAD_MICROS + RADIO_TX_SETTLE_MICROS + PacketAirtimeMicros(payloadSize, dataRate);
+  return firstPacket + ReplyDelayMicros(payloadSize, masterPackets, dataRate) + ReplyBurstMicros(payloadSize, masterPackets, slavePackets, dataRate) + RADIO_REPLY_GUARD_MICROS;
+}
+
+inline uint16_t ClampFrameRate(uint16_t frameRate, uint32_t minFrameMicros)
+{
+  uint32_t maxFrameRate = 1000000 / minFrameMicros;
+  if(maxFrameRate > RADIO_MAX_FRAME_RATE) { maxFrameRate = RADIO_MAX_FRAME_RATE; }
+  if(frameRate > maxFrameRate) { frameRate = maxFrameRate; }
+  return (frameRate < RADIO_MIN_FRAME_RATE) ? RADIO_MIN_FRAME_RATE : frameRate;
+}
+
+// Hop table generation. A fixed xorshift32 generator and shuffle so every core and toolchain produces the
+// same sequence from the same seed. With C++14 or newer a table can be built at compile time, eg
+// static constexpr HopTable hopTable = MakeHopTable(76, 124, 12345); then SetChannels(hopTable)
+#define HOP_TABLE_SIZE 126            // Every NRF24 channel, SetHopping picks how many of them are used
+#define HOP_MAX_FRAMES_PER_HOP 8      // The hop counter travels in 3 bits of byte 0
+#define HOP_RESERVED_CHANNEL 125     // Entry 0 of MakeHopTable tables, orthogonal tables have no fixed entry
+#define HOP_DEFAULT_SEED 0x9E3779B9  // Used in place of a seed of 0, which xorshift can't leave
+
+#if __cplusplus >= 201402L
+  #define RADIO_CONSTEXPR14 constexpr
+#else
+  #define RADIO_CONSTEXPR14 inline
+#endif
+
+struct HopTable
+{
+  uint8_t channels[HOP_TABLE_SIZE];
+};
+
+RADIO_CONSTEXPR14 uint32_t HopRandomNext(uint32_t& state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Shuffles a list of channels (max 124, others are skipped so bind traffic on 125 is only met on entry 0) and fills
+// the table from it after the reserved channel.
+// Lists with fewer channels than the table are repeated in the same shuffled order, so any prefix of the
+// table is a usable hop sequence
+RADIO_CONSTEXPR14 HopTable MakeHopTableFromList(const uint8_t* channelList, uint8_t listSize, uint32_t seed)
+{
+  HopTable table = {};
+  uint8_t pool[126] = {};
+  uint8_t count = 0;
+  for(uint8_t i = 0; i < listSize && count < 126; i++)
+  {
+    if(channelList[i] < HOP_RESERVED_CHANNEL) { pool[count++] = channelList[i]; }
+  }
+  if(count == 0) { pool[count++] = HOP_RESERVED_CHANNEL; }
+
+  uint32_t state = (seed != 0) ? seed : HOP_DEFAULT_SEED;
+  for(int i = count - 1; i > 0; i--)
+  {
+    uint8_t j = ((uint64_t)HopRandomNext(state) * (i + 1)) >> 32;  //Multiply shift instead of modulo. Without rejection it is biased by at most 126 in 2^32, negligible for tables this size
+    uint8_t temp = pool[i];
+    pool[i] = pool[j];
+    pool[j] = temp;
+  }
+
+  table.channels[0] = HOP_RESERVED_CHANNEL;
+  for(int i = 1; i < HOP_TABLE_SIZE; i++) { table.channels[i] = pool[(i - 1) % count]; }
+  return table;
+}
+
+// Every channel from lowerBound to upperBound inclusive
+RADIO_CONSTEXPR14 HopTable MakeHopTable(uint8_t lowerBound, uint8_t upperBound, uint32_t seed)
+{
+  uint8_t channelList[126] = {};
+  if(upperBound > 125) { upperBound = 125; }
+  if(lowerBound > upperBound) { lowerBound = upperBound; }
+  uint8_t count = upperBound - lowerBound + 1;
+  for(uint8_t i = 0; i < count; i++) { channelList[i] = lowerBound + i; }
+  return MakeHopTableFromList(channelList, count, seed);
+}
+
+// Hop sequences for sites with many pairs. The range is cut to p channels, p the largest prime that fits, and a
+// pair hops i -> (slope * i + offset) % p. Two pairs with different slopes share a channel once every p hops
+// however their sequences line up, where two shuffles can share many. Up to p - 1 pairs get different slopes,
+// either from a pair number handed out per pair or from a hash of the pair's addresses
+RADIO_CONSTEXPR14 uint8_t OrthogonalHopLength(uint8_t lowerBound, uint8_t upperBound)
+{
+  if(upperBound >= BIND_CHANNEL) { upperBound = BIND_CHANNEL - 1; }  //Never hop onto the bind channel
+  if(lowerBound > upperBound) { lowerBound = upperBound; }
+  uint8_t count = upperBound - lowerBound + 1;
+  for(uint8_t p = count; p > 2; p--)
+  {
+    bool isPrime = true;
+    for(uint8_t d = 2; d * d <= p; d++)
+    {
+      if(p % d == 0) { isPrime = false; break; }
+    }
+    if(isPrime) { return p; }
+  }
+  return (count < 2) ? count : 2;
+}
+
+// FNV-1a over the 5 byte Master and Slave addresses
+RADIO_CONSTEXPR14 uint32_t HopAddressHash(const uint8_t* masterAddress, const uint8_t* slaveAddress)
+{
+  uint32_t hash = 2166136261u;
+  for(int i = 0; i < 5; i++) { hash = (hash ^ masterAddress[i]) * 16777619u; }
+  for(int i = 0; i < 5; i++) { hash = (hash ^ slaveAddress[i]) * 16777619u; }
+  return hash;
+}
+
+// pairNumber 0 to p - 2 gives each pair its own slope, larger values (eg HopAddressHash) also pick an offset.
+// Hop over exactly OrthogonalHopLength channels, a prefix of the table is not orthogonal
+RADIO_CONSTEXPR14 HopTable MakeOrthogonalHopTable(uint8_t lowerBound, uint8_t upperBound, uint32_t pairNumber)
+{
+  HopTable table = {};
+  if(upperBound >= BIND_CHANNEL) { upperBound = BIND_CHANNEL - 1; }
+  if(lowerBound > upperBound) { lowerBound = upperBound; }
+  uint8_t length = OrthogonalHopLength(lowerBound, upperBound);
+  uint32_t slopes = (length > 1) ? length - 1 : 1;
+  uint32_t slope = 1 + pairNumber % slopes;
+  uint32_t offset = (pairNumber / slopes) % length;
+  for(int i = 0; i < HOP_TABLE_SIZE; i++) { table.channels[i] = lowerBound + (slope * (i % length) + offset) % length; }
+  return table;
+}
+
+// Wi-Fi coexistence. NRF24 channel n sits at 2400+n MHz, Wi-Fi channel 1-13 is centred at 2407+5*channel MHz
+// (14 at 2484) and spreads 11 MHz either side, see wifi-channels-frequencies.png
+#define WIFI_HALF_WIDTH_MHZ 11
+
+inline bool WifiOverlapsChannel(uint8_t wifiChannel, uint8_t nrfChannel)
+{
+  if(wifiChannel < 1 || wifiChannel > 14) { return false; }
+  int16_t centre = (wifiChannel == 14) ? 84 : 7 + 5 * wifiChannel;  //MHz above 2400, same units as the NRF24 channel
+  return abs((int16_t)nrfChannel - centre) <= WIFI_HALF_WIDTH_MHZ;
+}
+
+// Fills channels with every channel from lowerBound to upperBound outside the Wi-Fi channels set in wifiChannelMask
+// (bit n for Wi-Fi channel n), eg the ESP32's own WiFi.channel(). Returns how many were written, up to 126
+inline uint8_t ChannelsClearOfWifi(uint8_t* channels, uint8_t lowerBound, uint8_t upperBound, uint16_t wifiChannelMask)
+{
+  uint8_t written = 0;
+  if(upperBound > 125) { upperBound = 125; }
+  for(int channel = lowerBound; channel <= upperBound; channel++)
+  {
+    bool isClear = true;
+    for(uint8_t wifi = 1; wifi <= 14; wifi++)
+    {
+      if((wifiChannelMask & (1 << wifi)) && WifiOverlapsChannel(wifi, channel)) { isClear = false; }
+    }
+    if(isClear) { channels[written++] = channel; }
+  }
+  return written;
+}
+
+// Channel occupancy from the NRF24's received power detector, which latches when anything above -64dBm is heard
+// while listening. The clean channel list can go straight into GenerateChannels
+#define SURVEY_CHANNELS 126
+#define SURVEY_DEFAULT_DWELL_MICROS 170  // RX time the power detector needs before it can be trusted
+
+class SpectrumSurvey
+{
+private:
+  uint16_t hits[SURVEY_CHANNELS];
+  uint16_t sweeps = 0;
+  uint32_t channelsPerSecond = 0;
+
+public:
+  SpectrumSurvey() { Reset(); }
+
+  void Reset()
+  {
+    memset(hits, 0, sizeof(hits));
+    sweeps = 0;
+    channelsPerSecond = 0;
+  }
+
+  // Blocks for every sweep. Adds to the previous results until Reset, and leaves the radio out of RX
+  void Run(RF24& radio, uint16_t sweepCount, uint16_t dwellMicros)
+  {
+    uint32_t startTime = micros();
+    for(uint16_t sweep = 0; sweep < sweepCount; sweep++)
+    {
+      for(uint8_t channel = 0; channel < SURVEY_CHANNELS; channel++)
+      {
+        radio.setChannel(channel);
+        radio.startListening();
+        delayMicroseconds(dwellMicros);
+        radio.stopListening();
+        if(radio.testRPD() && hits[channel] < 0xFFFF) { hits[channel]++; }  //Stays latched until RX starts again
+      }
+      if(sweeps < 0xFFFF) { sweeps++; }
+    }
+    uint32_t elapsed = micros() - startTime;
+    if(elapsed > 0) { channelsPerSecond = (uint64_t)sweepCount * SURVEY_CHANNELS * 1000000 / elapsed; }
+  }
+
+  // Percent of sweeps the channel was busy in
+  uint8_t GetOccupancy(uint8_t channel)
+  {
+    if(channel >= SURVEY_CHANNELS || sweeps == 0) { return 0; }
+    return (uint32_t)hits[channel] * 100 / sweeps;
+  }
+
+  // Fills channels with up to count channels from lowerBound to upperBound, quietest first and lower channels first
+  // on a tie. The reserved channel 125 is left out. Returns how many were written
+  uint8_t GetCleanChannels(uint8_t* channels, uint8_t count, uint8_t lowerBound = 0, uint8_t upperBound = HOP_RESERVED_CHANNEL - 1)
+  {
+    bool isTaken[SURVEY_CHANNELS] = {};
+    if(upperBound >= HOP_RESERVED_CHANNEL) { upperBound = HOP_RESERVED_CHANNEL - 1; }
+    uint8_t written = 0;
+    while(written < count)
+    {
+      int best = -1;
+      for(int channel = lowerBound; channel <= upperBound; channel++)
+      {
+        if(isTaken[channel]) { continue; }
+        if(best < 0 || hits[channel] < hits[best]) { best = channel; }
+      }
+      if(best < 0) { break; }
+      isTaken[best] = true;
+      channels[written++] = best;
+    }
+    return written;
+  }
+
+  uint32_t GetChannelsPerSecond() { return channelsPerSecond; }  //Sweep speed of the last Run
+  uint16_t GetSweeps() { return sweeps; }
+};
+
+// Fixed bucket latency histogram. Bucket width is set from the frame time so 64 buckets cover 4 frames,
+// anything slower lands in the last bucket. The exact maximum is kept separately
+class LatencyHistogram
+{
+private:
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint32_t bucketMicros = 1;
+  uint32_t count = 0;
+  uint32_t maxMicros = 0;
+
+public:
+  void Reset(uint32_t bucketMicros)
+  {
+    memset(buckets, 0, sizeof(buckets));
+    this->bucketMicros = (bucketMicros < 1) ? 1 : bucketMicros;
+    count = 0;
+    maxMicros = 0;
+  }
+
+  void Add(uint32_t latencyMicros)
+  {
+    uint32_t bucket = latencyMicros / bucketMicros;
+    if(bucket >= LATENCY_BUCKETS) { bucket = LATENCY_BUCKETS - 1; }
+    buckets[bucket]++;
+    if(latencyMicros > maxMicros) { maxMicros = latencyMicros; }
+    count++;
+  }
+
+  // Upper edge of the bucket holding the requested percentile, never more than the real maximum
+  uint32_t Percentile(uint8_t percent)
+  {
+    if(count == 0) { return 0; }
+    uint32_t target = ((uint64_t)count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+      seen += buckets[i];
+      if(seen >= target)
+      {
+        uint32_t edge = (i + 1) * bucketMicros;
+        return (edge < maxMicros) ? edge : maxMicros;
+      }
+    }
+    return maxMicros;
+  }
+
+  uint32_t GetMax() { return maxMicros; }
+  uint32_t GetCount() { return count; }
+};
+
+struct SequenceStats
+{
+  uint32_t received;
+  uint32_t lost;         // Frames this stream didn't arrive in
+  uint32_t duplicates;   // Same sequence number as the last accepted packet
+  uint32_t stale;        // Older than the last accepted packet
+  uint16_t lastGap;      // Frames missed before the most recent packet
+  uint16_t longestGap;
+};
+
+// Loss accounting for one packet stream. The sender's sequence byte is its frame count, so the step from the last
+// accepted number is exactly how many frames were missed. Outages longer than the window are counted from our own
+// frame count instead since the byte may have wrapped
+class SequenceTracker
+{
+private:
+  SequenceStats stats;
+  uint8_t lastSequence = 0;
+  uint32_t lastFrame = 0;
+  bool hasLast = false;
+
+  void AddGap(uint32_t gap)
+  {
+    stats.lost += gap;
+    stats.lastGap = (gap > 0xFFFF) ? 0xFFFF : gap;
+    if(stats.lastGap > stats.longestGap) { stats.longestGap = stats.lastGap; }
+  }
+
+public:
+  void Reset()
+  {
+    memset(&stats, 0, sizeof(stats));
+    hasLast = false;
+  }
+
+  // Returns false for a duplicate or late packet that should be dropped. frame is the receiver's own frame count
+  bool Accept(uint8_t sequence, uint32_t frame)
+  {
+    uint32_t framesSinceLast = frame - lastFrame;
+    uint8_t step = sequence - lastSequence;
+    if(hasLast && framesSinceLast < SEQUENCE_WINDOW)
+    {
+      if(step == 0) { stats.duplicates++; return false; }
+      if(step >= SEQUENCE_WINDOW) { stats.stale++; return false; }
+      AddGap(step - 1);
+    }
+    else if(hasLast)
+    {
+      AddGap(framesSinceLast - 1);
+    }
+    hasLast = true;
+    lastSequence = sequence;
+    lastFrame = frame;
+    stats.received++;
+    return true;
+  }
+
+  SequenceStats GetStats() { return stats; }
+};
+
+// Receive quality over POWER_WINDOW_FRAMES frames, sent to the peer so it can set its transmit power
+class LinkQualityCounter
+{
+private:
+  uint16_t received = 0;
+  uint16_t strong = 0;
+  uint16_t expected = 0;
+  uint8_t frames = 0;
+  uint8_t report[POWER_REPORT_BYTES] = {0, 0, 0};
+
+public:
+  void Reset()
+  {
+    received = strong = expected = frames = 0;
+    memset(report, 0, sizeof(report));
+  }
+
+  void AddPacket(bool isStrong)
+  {
+    received++;
+    if(isStrong) { strong++; }
+  }
+
+  // Call once per frame with the packets the peer sends per frame. Starts a new report when the window is full
+  void EndFrame(uint8_t expectedPackets)
+  {
+    expected += expectedPackets;
+    if(++frames < POWER_WINDOW_FRAMES) { return; }
+
+    report[0]++;
+    report[1] = (expected > 0) ? (uint32_t)received * 100 / expected : 0;
+    report[2] = (received > 0) ? (uint32_t)strong * 100 / received : 0;
+    received = strong = expected = frames = 0;
+  }
+
+  void WriteReport(uint8_t* buffer) { memcpy(buffer, report, POWER_REPORT_BYTES); }
+  uint8_t GetDeliveryPercent() { return report[1]; }
+};
+
+// Steps our PA level from the peer's reports. Up a level as soon as delivery drops below the target, down a level
+// after several reports in a row with nearly every packet above the RPD threshold. Below that threshold the RPD says
+// nothing more, so a level down is only tried after a long run of reports with nothing lost, and backs off further
+// each time it has to be undone. The level never goes above the one given to Init, so an NRF without its own 3.3v
+// supply is never pushed past what it was set up for
+class PowerController
+{
+private:
+  uint8_t level = 0;
+  uint8_t maxLevel = 0;
+  uint8_t targetPercent = POWER_DEFAULT_TARGET;
+  uint8_t lastReport = 0;
+  uint8_t peerDeliveryPercent = 0;
+  bool hasReport = false;
+  uint8_t settleReports = 0;
+  uint8_t strongReports = 0;
+  uint8_t cleanReports = 0;
+  uint8_t probeReports = POWER_PROBE_WINDOWS;
+  bool isProbe = false;  //The last change was a level down tried without a strong signal
+  uint8_t framesSinceReport = 0;
+  uint8_t windowsSinceReport = 0;
+  uint16_t changes = 0;
+
+  bool SetLevel(uint8_t newLevel)
+  {
+    if(newLevel == level) { return false; }
+    level = newLevel;
+    settleReports = POWER_SETTLE_WINDOWS;
+    strongReports = cleanReports = 0;
+    changes++;
+    return true;
+  }
+
+public:
+  void Reset(uint8_t maxLevel, uint8_t targetPercent)
+  {
+    this->maxLevel = maxLevel;
+    this->targetPercent = targetPercent;
+    level = maxLevel;  //Start at full power and come down once the peer says it is strong
+    hasReport = false;
+    settleReports = strongReports = cleanReports = framesSinceReport = windowsSinceReport = 0;
+    probeReports = POWER_PROBE_WINDOWS;
+    isProbe = false;
+    changes = 0;
+  }
+
+  // Call with the peer's report bytes whenever its PACKET1 arrives. Returns true when the level changed
+  bool OnReport(const uint8_t* report)
+  {
+    if(hasReport && report[0] == lastReport) { return false; }  //Same window as last time
+    bool isFirst = !hasReport;
+    hasReport = true;
+    lastReport = report[0];
+    peerDeliveryPercent = report[1];
+    windowsSinceReport = 0;
+    if(isFirst) { return false; }  //The peer's window may have started before we were heard
+    if(settleReports > 0) { settleReports--; return false; }
+
+    uint8_t deliveryPercent = report[1];
+    uint8_t strongPercent = report[2];
+    if(deliveryPercent < targetPercent)
+    {
+      if(isProbe && probeReports < POWER_PROBE_MAX_WINDOWS) { probeReports *= 2; }
+      isProbe = false;
+      return (level < maxLevel) ? SetLevel(level + 1) : false;
+    }
+
+    strongReports = (strongPercent >= POWER_STRONG_PERCENT) ? strongReports + 1 : 0;
+    cleanReports = (deliveryPercent >= 100) ? cleanReports + 1 : 0;
+    if(level == 0) { return false; }
+    if(strongReports >= POWER_STEP_DOWN_WINDOWS)
+    {
+      isProbe = false;
+      return SetLevel(level - 1);
+    }
+    if(cleanReports >= probeReports)
+    {
+      isProbe = true;
+      return SetLevel(level - 1);
+    }
+    return false;
+  }
+
+  // Call once per frame. Back to full power if the peer's reports stop. Returns true when the level changed
+  bool EndFrame()
+  {
+    if(++framesSinceReport < POWER_WINDOW_FRAMES) { return false; }
+    framesSinceReport = 0;
+    if(++windowsSinceReport < POWER_REPORT_TIMEOUT_WINDOWS) { return false; }
+    windowsSinceReport = 0;
+    hasReport = false;
+    return SetLevel(maxLevel);
+  }
+
+  uint8_t GetLevel() { return level; }
+  uint16_t GetChanges() { return changes; }
+  uint8_t GetPeerDeliveryPercent() { return peerDeliveryPercent; }
+};
+
+// Per phase cycle counts for the radio hot path. CCOUNT on ESP32, micros() as a stand in elsewhere
+#define PROFILE_WAIT 0               // Waiting for the frame boundary, this is the frame's headroom
+#define PROFILE_FILL 1               // Fill frame callback
+#define PROFILE_SEND 2               // Loading the TX FIFO and waiting for the burst to go out
+#define PROFILE_HOP 3                // Channel change and switching back to listening
+#define PROFILE_RECEIVE 4            // Draining the RX FIFO
+#define PROFILE_CLEAR 5              // Clearing the send and receive packet buffers
+#define PROFILE_PHASES 6
+
+inline uint32_t RadioCycleCount()
+{
+#if defined(ESP32)
+  return ESP.getCycleCount();
+#else
+  return micros();
+#endif
+}
+
+inline uint32_t RadioCyclesPerMicro()
+{
+#if defined(ESP32)
+  return ESP.getCpuFreqMHz();
+#else
+  return 1;
+#endif
+}
+
+struct ProfileStats
+{
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint32_t count;
+  uint64_t totalCycles;
+
+  uint32_t AverageCycles() const { return (count > 0) ? totalCycles / count : 0; }
+};
+
+class RadioProfiler
+{
+private:
+  ProfileStats phases[PROFILE_PHASES];
+
+public:
+  RadioProfiler() { Reset(); }
+
+  void Reset()
+  {
+    for(int i = 0; i < PROFILE_PHASES; i++)
+    {
+      phases[i].minCycles = 0xFFFFFFFF;
+      phases[i].maxCycles = 0;
+      phases[i].count = 0;
+      phases[i].totalCycles = 0;
+    }
+  }
+
+  void Add(uint8_t phase, uint32_t cycles)
+  {
+    ProfileStats& stats = phases[phase];
+    if(cycles < stats.minCycles) { stats.minCycles = cycles; }
+    if(cycles > stats.maxCycles) { stats.maxCycles = cycles; }
+    stats.totalCycles += cycles;
+    stats.count++;
+  }
+
+  ProfileStats Get(uint8_t phase) { return phases[(phase < PROFILE_PHASES) ? phase : 0]; }
+};
+
+#ifdef RADIO_PROFILE
+  #define RADIO_PROFILE_START(name) uint32_t name = RadioCycleCount()
+  #define RADIO_PROFILE_END(phase, name) profiler.Add((phase), RadioCycleCount() - (name))
+#else
+  #define RADIO_PROFILE_START(name)
+  #define RADIO_PROFILE_END(phase, name)
+#endif
+
+// Trace ring. Each event is 8 bytes and costs an atomic increment and 3 stores, safe from the IRQ handler.
+// The ring keeps the last RADIO_TRACE_SIZE events. Decode a dump with tools/decode_trace.py
+#define RADIO_TRACE_SIZE 256         // Must be a power of 2
+#define RADIO_TRACE_VERSION 1
+
+#define TRACE_SOURCE_MASTER 0x00
+#define TRACE_SOURCE_SLAVE 0x10
+
+#define TRACE_FRAME_START 1          // a: hop counter, b: channel index
+#define TRACE_TX_DONE 2              // a: packets sent, b: micros from frame start to the first bit on air
+#define TRACE_IRQ 3                  // a: 1 if used for sync
+#define TRACE_RX 4                   // a: packet id, b: pipe
+#define TRACE_HOP 5                  // a: channel index, b: channel
+#define TRACE_DRIFT 6                // b: drift applied to the frame end in micros (signed)
+#define TRACE_STATE 7                // a: old state, b: new state
+#define TRACE_POWER 8                // a: new PA level, b: delivery percent the peer last reported
+
+struct RadioTraceEvent
+{
+  uint32_t timeStamp;
+  uint8_t type;  // Source in the high nibble, event in the low nibble
+  uint8_t a;
+  uint16_t b;
+};
+
+struct RadioTraceRing
+{
+  RadioTraceEvent events[RADIO_TRACE_SIZE];
+  uint32_t head;  // Total events ever written
+};
+
+inline RadioTraceRing& RadioTraceBuffer()
+{
+  static RadioTraceRing ring;  // Zero initialised at load, no guard needed so it is safe to use from the IRQ
+  return ring;
+}
+
+inline void RadioTraceRecord(uint8_t type, uint8_t a, uint16_t b)
+{
+  RadioTraceRing& ring = RadioTraceBuffer();
+  uint32_t index = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED) & (RADIO_TRACE_SIZE - 1);
+  RadioTraceEvent& event = ring.events[index];
+  event.timeStamp = micros();
+  event.type = type;
+  event.a = a;
+  event.b = b;
+}
+
+#ifdef RADIO_TRACE
+  #define RADIO_TRACE_EVENT(type, a, b) RadioTraceRecord((type), (a), (b))
+#else
+  #define RADIO_TRACE_EVENT(type, a, b)
+#endif
+
+// Writes "NRFT", version, event size, event count (uint16) then the events oldest first, all little endian.
+// Events recorded while dumping can tear, so dump when the link is idle or accept a few bad entries
+inline void RadioTraceDump(Print& out)
+{
+  RadioTraceRing& ring = RadioTraceBuffer();
+  uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+  uint16_t count = (head < RADIO_TRACE_SIZE) ? head : RADIO_TRACE_SIZE;
+  uint8_t header[8] = {'N', 'R', 'F', 'T', RADIO_TRACE_VERSION, sizeof(RadioTraceEvent), (uint8_t)(count & 0xFF), (uint8_t)(count >> 8)};
+  out.write(header, sizeof(header));
+
+  for(uint32_t i = head - count; i != head; i++)
+  {
+    out.write((const uint8_t*)&ring.events[i & (RADIO_TRACE_SIZE - 1)], sizeof(RadioTraceEvent));
+  }
+}
+
+#endif
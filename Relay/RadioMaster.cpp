@@ -0,0 +1,649 @@
+#include "RadioMaster.h"
+#if !defined(ESP32)
+  #error "RadioMaster needs the ESP32 Arduino core, its radio task is a FreeRTOS task pinned to a core"
+#endif
+
+void RadioMaster::Init(_SPI* spiPort, uint8_t pinCE, uint8_t PinCS, int8_t powerLevel, uint8_t packetSize, uint8_t numberOfSendPackets, uint8_t numberOfReceivePackets, uint16_t frameRate)
+{
+  //Packets
+  this->numberOfSendPackets = (numberOfSendPackets < 0) ? 0 : ((numberOfSendPackets > 3) ? 3 : numberOfSendPackets);
+  this->numberOfReceivePackets = (numberOfReceivePackets < 0) ? 0 : ((numberOfReceivePackets > 3) ? 3 : numberOfReceivePackets);
+  this->packetSize = (packetSize < 1) ? 1 : ((packetSize > 32) ? 32 : packetSize);
+  powerLevel = (powerLevel < 0) ? 0 : ((powerLevel > 3) ? 3: powerLevel);
+  maxPowerLevel = powerLevel;
+  linkQuality.Reset();
+  powerController.Reset(maxPowerLevel, powerTargetPercent);
+
+  //Buffers already attached (StaticRadio variants or a previous Init) are reused so Init never leaks
+  for (int i = 0; i < this->numberOfSendPackets; ++i) 
+  {
+    if(sendPackets[i] == nullptr) { sendPackets[i] = new uint8_t[MAXPACKETSIZE](); }
+  }
+
+  for (int i = 0; i < this->numberOfReceivePackets; ++i) 
+  {
+    if(recievePackets[i] == nullptr) { recievePackets[i] = new uint8_t[MAXPACKETSIZE](); }
+  }
+
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+
+  //Radio
+  spiPort->begin();
+  radio.begin(spiPort, pinCE, PinCS);
+  radio.stopListening();
+  radio.powerDown();
+  radio.setPALevel(powerLevel);
+  // radio.setAddressWidth(3);
+  radio.openReadingPipe(1, address[1]);  // Slave address
+  radio.openWritingPipe(address[0]);     // Master address
+  radio.setDataRate(dataRate);
+  TrimRadioDelays(radio);
+  radio.setAutoAck(false);
+  radio.setRetries(0, 0);
+  radio.setPayloadSize(this->packetSize);
+  radio.setChannel(channels_Gen[currentChannelIndex]);
+  radio.maskIRQ(true, true, false);
+  radio.powerUp();
+  radio.startListening();
+  isTxReady = false;
+
+  //Frame Timing
+  //Clamp between 10 and 500, or lower if the data rate and packets don't fit in a frame
+  this->frameRate = ClampFrameRate(frameRate, MinFrameMicros(this->packetSize, this->numberOfSendPackets, this->numberOfReceivePackets, dataRate));
+  microsPerFrame = 1000000 / this->frameRate;
+  microsRemainder = 1000000 % this->frameRate;
+  frameRemainder = 0;
+  slaveReplyOffset = RADIO_TX_SETTLE_MICROS + PacketAirtimeMicros(this->packetSize, dataRate) + ReplyDelayMicros(this->packetSize, this->numberOfSendPackets, dataRate);
+  slaveReplyDelay = RADIO_SPI_LOAD_MICROS + slaveReplyOffset;
+  slaveBurstMicros = ReplyBurstMicros(this->packetSize, this->numberOfSendPackets, this->numberOfReceivePackets, dataRate);
+  ResetLatencyStats();
+  ResetSequenceStats();
+}
+
+void RadioMaster::SetAddresses(const char* masterID, const char* slaveID)
+{
+    strncpy((char*)address[0], masterID, 5);  // Master address
+    strncpy((char*)address[1], slaveID, 5);   // Slave address
+}
+
+bool RadioMaster::Bind(LinkParameters& link, uint32_t timeoutMillis)
+{
+  //Fresh addresses and seed for this pair. The channel range and flags are left as the caller set them
+  for(int i = 0; i < 5; i++)
+  {
+    link.masterAddress[i] = RandomAddressByte();
+    link.slaveAddress[i] = RandomAddressByte();
+  }
+  link.hopSeed = RadioRandom();
+  link.frameRate = frameRate;
+  link.channelsToHop = channelsToHop;
+  link.framesPerHop = framesPerHop;
+  link.microsPerFrame = 0;
+  SealLink(link);
+
+  uint8_t offer[BIND_PAYLOAD_SIZE] = {BIND_OFFER};
+  memcpy(&offer[1], &link, sizeof(link));
+  radio.stopListening();
+  radio.setChannel(BIND_CHANNEL);
+  radio.setPayloadSize(BIND_PAYLOAD_SIZE);
+  radio.openWritingPipe((const uint8_t*)BIND_ADDRESS);
+  radio.openReadingPipe(1, (const uint8_t*)BIND_ADDRESS);
+
+  bool isBound = false;
+  uint32_t startTime = millis();
+  while(!isBound && millis() - startTime < timeoutMillis)
+  {
+    radio.stopListening();
+    radio.write(offer, BIND_PAYLOAD_SIZE);
+    radio.startListening();
+
+    uint32_t listenStart = micros();
+    while(!isBound && micros() - listenStart < BIND_REPLY_MICROS)
+    {
+      if(!radio.available())
+      {
+        vTaskDelay(1);  //The accept waits in the RX FIFO, let same core tasks and the watchdog run meanwhile
+        continue;
+      }
+      uint8_t reply[BIND_PAYLOAD_SIZE];
+      radio.read(reply, BIND_PAYLOAD_SIZE);
+      uint16_t checksum;
+      memcpy(&checksum, &reply[1], sizeof(checksum));
+      isBound = (reply[0] == BIND_ACCEPT && checksum == link.checksum);
+    }
+  }
+
+  //Back to how Init left the radio
+  radio.stopListening();
+  radio.setPayloadSize(packetSize);
+  radio.openReadingPipe(1, address[1]);
+  radio.openWritingPipe(address[0]);
+  radio.setChannel(channels_Gen[currentChannelIndex]);
+  radio.startListening();
+  isTxReady = false;
+  return isBound;
+}
+
+void RadioMaster::UseLink(const LinkParameters& link)
+{
+    memcpy(address[0], link.masterAddress, 5);  //Random bytes, may hold a 0 so not through SetAddresses
+    memcpy(address[1], link.slaveAddress, 5);
+    SetHopping(link.channelsToHop, link.framesPerHop);
+    if(link.flags & LINK_ORTHOGONAL) { GenerateOrthogonalChannels(link.lowerBound, link.upperBound); }
+    else { GenerateChannels(link.lowerBound, link.upperBound, link.hopSeed); }
+}
+
+void RadioMaster::GenerateChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t seed)
+{
+    SetChannels(MakeHopTable(lowerBound, upperBound, seed));
+}
+
+void RadioMaster::SetHopping(uint8_t channelsToHop, uint8_t framesPerHop)
+{
+    this->channelsToHop = (channelsToHop < 1) ? 1 : ((channelsToHop > HOP_TABLE_SIZE) ? HOP_TABLE_SIZE : channelsToHop);
+    this->framesPerHop = (framesPerHop < 1) ? 1 : ((framesPerHop > HOP_MAX_FRAMES_PER_HOP) ? HOP_MAX_FRAMES_PER_HOP : framesPerHop);
+    currentChannelIndex = 0;
+    channelHopCounter = 0;
+}
+
+void RadioMaster::SetChannels(const HopTable& table)
+{
+    memcpy(channels_Gen, table.channels, sizeof(channels_Gen));
+}
+
+void RadioMaster::GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound)
+{
+    GenerateOrthogonalChannels(lowerBound, upperBound, HopAddressHash(address[0], address[1]));
+}
+
+void RadioMaster::GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t pairNumber)
+{
+    SetChannels(MakeOrthogonalHopTable(lowerBound, upperBound, pairNumber));
+    channelsToHop = OrthogonalHopLength(lowerBound, upperBound);
+    currentChannelIndex = 0;
+    channelHopCounter = 0;
+}
+
+void RadioMaster::GenerateChannelsFromList(const uint8_t* channels, uint8_t count, uint32_t seed)
+{
+    SetChannels(MakeHopTableFromList(channels, count, seed));
+}
+
+void RadioMaster::SurveySpectrum(SpectrumSurvey& survey, uint16_t sweeps, uint16_t dwellMicros)
+{
+    survey.Run(radio, sweeps, dwellMicros);
+
+    //Back on the hop channel and listening, as Init left it
+    radio.setChannel(channels_Gen[currentChannelIndex]);
+    radio.startListening();
+    isTxReady = false;
+}
+
+void RadioMaster::ClearSendPackets()
+{
+  for(int i = 0; i < numberOfSendPackets; i++)
+  {
+    memset(sendPackets[i], 0, packetSize);
+    byteAddCounter[i] = sendHeaderSize[i];
+    isSendStamped[i] = false;
+  }
+}
+
+void RadioMaster::ClearReceivePackets()
+{
+  for(int i = 0; i < numberOfReceivePackets; i++)
+  {
+    receivePacketsAvailable[i] = false;
+    memset(recievePackets[i], 0, packetSize);
+    byteReceiveCounter[i] = receiveHeaderSize[i];
+  }
+}
+
+void RadioMaster::AdvanceFrame()
+{
+  currentFrameStart = frameTimeEnd;
+  uint32_t newTime = frameTimeEnd + microsPerFrame;
+  frameRemainder += microsRemainder;
+  if(frameRemainder >= frameRate)
+  {
+    frameRemainder -= frameRate;
+    newTime++;
+  }
+  isOverFlowFrame = (newTime < frameTimeEnd);
+  frameTimeEnd = newTime;
+}
+
+void RadioMaster::AlignFrame(uint32_t frameStart)
+{
+  //IsFrameReady shifts both times by half the range when they sit either side of the micros() wrap
+  uint32_t currentTimeStamp = micros();
+  isOverFlowFrame = ((int32_t)(frameStart - currentTimeStamp) > 0) != (frameStart > currentTimeStamp);
+  frameTimeEnd = frameStart;
+  frameRemainder = 0;
+}
+
+void RadioMaster::RandomiseFramePhase()
+{
+  AlignFrame(micros() + RadioRandom() % microsPerFrame);
+}
+
+bool RadioMaster::IsFrameReady()
+{ 
+  uint32_t currentTimeStamp = micros();
+  uint32_t localFrameTimeEnd = frameTimeEnd;
+   
+  if(isOverFlowFrame)
+  {
+    currentTimeStamp -= 0x80000000;
+    localFrameTimeEnd -= 0x80000000;
+  }
+
+  if (currentTimeStamp >= localFrameTimeEnd)
+	{
+    AdvanceFrame();
+    return true;
+  }
+    return false;
+}
+
+void RadioMaster::UpdateRecording()
+{
+  frameCount++;
+  if(isPowerControlEnabled)
+  {
+    linkQuality.EndFrame(numberOfReceivePackets);
+    ApplyPowerLevel(powerController.EndFrame());
+  }
+  secondCounter++;
+  isSecondTick = false;
+  if(secondCounter >= frameRate)
+  {
+    secondCounter = 0;
+    receivedPerSecond = recievedPacketCount;
+    recievedPacketCount = 0;
+    txStartLatencyPerSecond = txStartLatencyMax;
+    txStartLatencyMax = 0;
+    replyMicrosPerSecond = replyMicrosMax;
+    replyMicrosMax = 0;
+    isSecondTick = true;
+  }
+}
+
+void RadioMaster::UpdateTxStartLatency(uint32_t latency)
+{
+  txStartLatency = latency;
+  if(latency > txStartLatencyMax) { txStartLatencyMax = latency; }
+}
+
+void RadioMaster::UpdateReplyMicros(uint32_t roundTrip)
+{
+  replyMicros = roundTrip;
+  if(roundTrip > replyMicrosMax) { replyMicrosMax = roundTrip; }
+}
+
+void RadioMaster::WaitAndSend()
+{
+  RADIO_PROFILE_START(waitStart);
+  while(!IsFrameReady())
+  {
+    //Spin the last tick, at high frame rates a whole tick of lateness is a large part of the frame
+    if((int32_t)(frameTimeEnd - micros()) > RADIO_TICK_MICROS) { vTaskDelay(1); }
+  }
+  RADIO_PROFILE_END(PROFILE_WAIT, waitStart);
+  uint32_t frameStartTimeStamp = micros();
+  RADIO_TRACE_EVENT(TRACE_SOURCE_MASTER | TRACE_FRAME_START, channelHopCounter, currentChannelIndex);
+
+  RADIO_PROFILE_START(fillStart);
+  if(fillFrameCallback != nullptr) { fillFrameCallback(fillFrameCallbackContext); }
+  RADIO_PROFILE_END(PROFILE_FILL, fillStart);
+
+  RADIO_PROFILE_START(sendStart);
+  if(!isTxReady) { radio.stopListening(); }  //Normally done at the end of Receive, off the frame start
+  isTxReady = false;
+
+  //Queue the whole burst into the 3 level TX FIFO. The first writeFast raises CE so the
+  //packets go out back to back, then a single txStandBy waits for the FIFO to empty
+  uint32_t sendStartTime = micros();
+  for(int i = 0; i < numberOfSendPackets; i++)
+  {
+    sendPackets[i][0] = i;
+    sendPackets[i][0] |= ((channelHopCounter << 5) & 0xE0);
+    if(isLatencyEnabled) { WriteLatencyHeader(sendPackets[i], i, sendStartTime); }
+    if(isSequenceEnabled) { sendPackets[i][sequenceOffset] = frameCount; }
+    if(isTimeSyncEnabled && i == PACKET1) { WriteTimeSyncHeader(sendPackets[i]); }
+    if(isPowerControlEnabled && i == PACKET1) { linkQuality.WriteReport(&sendPackets[i][sendHeaderSize[i] - POWER_REPORT_BYTES]); }
+    radio.writeFast(sendPackets[i], packetSize);
+    if(i == 0)
+    {
+      uint32_t txStartTimeStamp = micros();
+      UpdateTxStartLatency(txStartTimeStamp - frameStartTimeStamp + RADIO_TX_SETTLE_MICROS);  //CE is high, the first bit follows the PLL settling
+      slaveReplyDelay = (txStartTimeStamp - currentFrameStart) + slaveReplyOffset;
+    }
+  }
+  if(numberOfSendPackets > 0) { radio.txStandBy(); }
+  RADIO_TRACE_EVENT(TRACE_SOURCE_MASTER | TRACE_TX_DONE, numberOfSendPackets, txStartLatency);
+  RADIO_PROFILE_END(PROFILE_SEND, sendStart);
+
+  RADIO_PROFILE_START(hopStart);
+  channelHopCounter++;
+  if(channelHopCounter >= framesPerHop)
+  { 
+    channelHopCounter = 0;
+    currentChannelIndex++;
+    if(currentChannelIndex >= channelsToHop) { currentChannelIndex = 0; }
+    radio.setChannel(channels_Gen[currentChannelIndex]);
+    RADIO_TRACE_EVENT(TRACE_SOURCE_MASTER | TRACE_HOP, currentChannelIndex, channels_Gen[currentChannelIndex]);
+  }
+
+  radio.startListening();
+  RADIO_PROFILE_END(PROFILE_HOP, hopStart);
+
+  RADIO_PROFILE_START(clearStart);
+  ClearSendPackets();
+  RADIO_PROFILE_END(PROFILE_CLEAR, clearStart);
+}
+
+void RadioMaster::Receive()
+{
+  RADIO_PROFILE_START(clearStart);
+  ClearReceivePackets();
+  RADIO_PROFILE_END(PROFILE_CLEAR, clearStart);
+
+  RADIO_PROFILE_START(receiveStart);
+  //The Slave's reply follows our burst, so wait for it here instead of picking it up next frame.
+  //Sleep until it is due, poll closely around when it should land, then fall back to polling each tick
+  //in case the Slave's fill callback held it up. Give up halfway between then and our next frame
+  uint32_t replyDue = currentFrameStart + slaveReplyDelay + slaveBurstMicros;
+  uint32_t replyDeadline = replyDue + (int32_t)(microsPerFrame - slaveReplyDelay - slaveBurstMicros) / 2;
+  uint8_t readCount = 0;
+  while(readCount < numberOfReceivePackets)
+  {
+    if(ReadNextPacket())
+    {
+      readCount++;
+      if(readCount == numberOfReceivePackets) { UpdateReplyMicros(micros() - currentFrameStart); }
+      continue;
+    }
+    uint32_t now = micros();
+    if((int32_t)(now - replyDeadline) >= 0) { break; }
+    int32_t untilDue = replyDue - now;
+    int32_t untilDeadline = replyDeadline - now;
+    bool isWaitLong = (untilDue > RADIO_TICK_MICROS || untilDue < -RADIO_REPLY_GUARD_MICROS);
+    if(isWaitLong && untilDeadline > RADIO_TICK_MICROS) { vTaskDelay(1); }  //Spin the last tick so a missing reply never holds us past the deadline
+  }
+
+  //Drain anything else, eg a late packet. Stops at the first empty status read
+  for(int i = 0; i < RADIO_RX_FIFO_DEPTH && ReadNextPacket(); i++) {}
+
+  //Nothing more is due before our next burst, so leave RX now and keep its register writes off the frame start
+  radio.stopListening();
+  isTxReady = true;
+  RADIO_PROFILE_END(PROFILE_RECEIVE, receiveStart);
+
+  UpdateRecording();
+  DispatchReceived();
+}
+
+bool RadioMaster::ReadNextPacket()
+{
+  //One status read tells us both whether anything is waiting and which pipe it came in on
+  uint8_t pipe;
+  if(!radio.available(&pipe)) { return false; }
+
+  uint8_t currentPacket[packetSize];
+  radio.read(currentPacket, packetSize);
+  uint8_t firstByte = currentPacket[0];
+  uint8_t packetId = firstByte & 0x03;
+  if(packetId >= numberOfReceivePackets) { return true; }  //Mismatched packet count on the Slave
+  if(isSequenceEnabled && !sequenceTrackers[packetId].Accept(currentPacket[sequenceOffset], frameCount)) { return true; }  //Late or repeated, keep what we have
+  recievedPacketCount++;  //Counted after the drops, as the Slave does
+  memcpy(recievePackets[packetId], currentPacket, packetSize);
+  receivePacketsAvailable[packetId] = true;
+  receivePipes[packetId] = pipe;
+  RADIO_TRACE_EVENT(TRACE_SOURCE_MASTER | TRACE_RX, packetId, 1);
+  if(isLatencyEnabled) { RecordLatency(packetId, currentPacket, SlaveFrameStart(micros())); }
+  if(isTimeSyncEnabled && packetId == PACKET1) { ReadPeerTimeSync(currentPacket); }
+  if(isPowerControlEnabled)
+  {
+    linkQuality.AddPacket(radio.testRPD());
+    if(packetId == PACKET1) { ApplyPowerLevel(powerController.OnReport(&currentPacket[receiveHeaderSize[PACKET1] - POWER_REPORT_BYTES])); }
+  }
+  return true;
+}
+
+void RadioMaster::DispatchReceived()
+{
+  if(receiveCallback != nullptr)
+  {
+    for(int i = 0; i < numberOfReceivePackets; i++)
+    {
+      if(receivePacketsAvailable[i]) { receiveCallback(i, receiveCallbackContext); }
+    }
+  }
+
+  if(notifyTask != nullptr) { xTaskNotifyGive(notifyTask); }
+}
+
+bool RadioMaster::StartTask(BaseType_t core, UBaseType_t priority, uint32_t stackSize)
+{
+  if(radioTask != nullptr) { return false; }
+  return xTaskCreatePinnedToCore(RadioTask, "RadioMaster", stackSize, this, priority, &radioTask, core) == pdPASS;
+}
+
+void RadioMaster::RadioTask(void* instance)
+{
+  RadioMaster* self = static_cast<RadioMaster*>(instance);
+  while(true)
+  {
+    self->WaitAndSend();
+    self->Receive();
+  }
+}
+
+void RadioMaster::EnableLatencyStats()
+{
+  isLatencyEnabled = true;
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+  ResetLatencyStats();
+  ResetSequenceStats();
+}
+
+void RadioMaster::EnableTimeSync()
+{
+  isTimeSyncEnabled = true;
+  peerUncertainty = TIMESYNC_INVALID;
+  peerRoundTrip = TIMESYNC_NO_SAMPLE;
+  peerSampleCount = 0;
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+}
+
+void RadioMaster::EnablePowerControl(uint8_t targetPercent)
+{
+  isPowerControlEnabled = true;
+  powerTargetPercent = (targetPercent > 100) ? 100 : targetPercent;
+  linkQuality.Reset();
+  powerController.Reset(maxPowerLevel, powerTargetPercent);
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+}
+
+void RadioMaster::ApplyPowerLevel(bool hasChanged)
+{
+  if(!hasChanged) { return; }
+  radio.setPALevel(powerController.GetLevel());  //Takes effect from the next burst
+  RADIO_TRACE_EVENT(TRACE_SOURCE_MASTER | TRACE_POWER, powerController.GetLevel(), powerController.GetPeerDeliveryPercent());
+}
+
+void RadioMaster::EnableSequenceNumbers()
+{
+  isSequenceEnabled = true;
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+  ResetSequenceStats();
+}
+
+void RadioMaster::UpdateHeaderSizes()
+{
+  sequenceOffset = 1 + (isLatencyEnabled ? 2 : 0);
+  headerSize = sequenceOffset + (isSequenceEnabled ? 1 : 0);
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    bool hasTimeSync = isTimeSyncEnabled && i == PACKET1;
+    uint8_t powerReportSize = (isPowerControlEnabled && i == PACKET1) ? POWER_REPORT_BYTES : 0;  //Last in the header
+    sendHeaderSize[i] = headerSize + (hasTimeSync ? TIMESYNC_MASTER_BYTES : 0) + powerReportSize;
+    receiveHeaderSize[i] = headerSize + (hasTimeSync ? TIMESYNC_SLAVE_BYTES : 0) + powerReportSize;
+  }
+}
+
+void RadioMaster::ResetLatencyStats()
+{
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    latencyHistograms[i].Reset(microsPerFrame / 16);
+  }
+}
+
+uint32_t RadioMaster::GetLatencyPercentileMicros(uint8_t packetId, uint8_t percent)
+{
+  if(packetId >= MAXPACKETS) { return 0; }
+  return latencyHistograms[packetId].Percentile(percent);
+}
+
+uint32_t RadioMaster::GetMaxLatencyMicros(uint8_t packetId)
+{
+  if(packetId >= MAXPACKETS) { return 0; }
+  return latencyHistograms[packetId].GetMax();
+}
+
+void RadioMaster::ResetSequenceStats()
+{
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    sequenceTrackers[i].Reset();
+  }
+}
+
+SequenceStats RadioMaster::GetSequenceStats(uint8_t packetId)
+{
+  if(packetId >= MAXPACKETS) { SequenceStats empty = {}; return empty; }
+  return sequenceTrackers[packetId].GetStats();
+}
+
+uint8_t RadioMaster::GetReceivedPayload(uint8_t packetId, uint8_t* buffer)
+{
+  if(packetId >= numberOfReceivePackets || !receivePacketsAvailable[packetId]) { return 0; }
+  uint8_t length = packetSize - receiveHeaderSize[packetId];
+  memcpy(buffer, &recievePackets[packetId][receiveHeaderSize[packetId]], length);
+  return length;
+}
+
+void RadioMaster::SetSendPayload(uint8_t packetId, const uint8_t* payload, uint8_t length)
+{
+  if(packetId >= numberOfSendPackets) { return; }
+  uint8_t maxLength = packetSize - sendHeaderSize[packetId];
+  if(length > maxLength) { length = maxLength; }
+  if(byteAddCounter[packetId] == sendHeaderSize[packetId]) { StampEnqueue(packetId); }
+  memcpy(&sendPackets[packetId][sendHeaderSize[packetId]], payload, length);
+  byteAddCounter[packetId] = sendHeaderSize[packetId] + length;
+}
+
+void RadioMaster::StampEnqueue(uint8_t packetId)
+{
+  if(!isLatencyEnabled) { return; }
+  sendEnqueueTime[packetId] = micros();
+  isSendStamped[packetId] = true;
+}
+
+void RadioMaster::WriteLatencyHeader(uint8_t* packet, uint8_t packetId, uint32_t sendStartTime)
+{
+  //Age is relative to the start of our burst rather than the frame start. The Slave only knows when our burst landed,
+  //so this way the fill callback and the time to get the burst going are counted in its latency too
+  int16_t age = LATENCY_NO_DATA;
+  if(isSendStamped[packetId])
+  {
+    int32_t ageMicros = (int32_t)(sendStartTime - sendEnqueueTime[packetId]) / (1 << LATENCY_AGE_SHIFT);
+    age = (ageMicros < -32768) ? -32768 : ((ageMicros >= LATENCY_NO_DATA) ? LATENCY_NO_DATA - 1 : ageMicros);
+  }
+  memcpy(&packet[1], &age, sizeof(age));
+}
+
+void RadioMaster::RecordLatency(uint8_t packetId, const uint8_t* packet, uint32_t remoteFrameStart)
+{
+  int16_t age;
+  memcpy(&age, &packet[1], sizeof(age));
+  if(age == LATENCY_NO_DATA) { return; }
+
+  int32_t latency = (int32_t)(micros() - remoteFrameStart) + (int32_t)age * (1 << LATENCY_AGE_SHIFT);
+  latencyHistograms[packetId].Add((latency < 0) ? 0 : latency);
+}
+
+uint32_t RadioMaster::SlaveFrameStart(uint32_t timeStamp)
+{
+  //The reply normally lands in the same frame, a late one from the Slave's previous frame is still handled
+  uint32_t slaveFrameStart = currentFrameStart + slaveReplyDelay;
+  if((int32_t)(timeStamp - slaveFrameStart) < 0) { slaveFrameStart -= microsPerFrame; }
+  return slaveFrameStart;
+}
+
+void RadioMaster::WriteTimeSyncHeader(uint8_t* packet)
+{
+  //Taken just before writeFast, as the Slave takes its reply time, so the two radio pipelines match
+  uint32_t sendTime = micros();
+  uint16_t uncertainty = GetLinkTimeUncertaintyMicros();
+  memcpy(&packet[headerSize], &sendTime, sizeof(sendTime));
+  memcpy(&packet[headerSize + 4], &peerOffset, sizeof(peerOffset));
+  memcpy(&packet[headerSize + 8], &uncertainty, sizeof(uncertainty));
+}
+
+void RadioMaster::ReadPeerTimeSync(const uint8_t* packet)
+{
+  uint32_t receiveTime = micros();
+  uint32_t sendTime;
+  uint32_t slaveReceiveTime;
+  uint32_t slaveHoldTime;
+  memcpy(&sendTime, &packet[headerSize], sizeof(sendTime));
+  memcpy(&slaveReceiveTime, &packet[headerSize + 4], sizeof(slaveReceiveTime));
+  memcpy(&slaveHoldTime, &packet[headerSize + 8], sizeof(slaveHoldTime));
+  if(slaveHoldTime == TIMESYNC_NO_SAMPLE) { return; }
+
+  //NTP's four time stamps: our send, the Slave's receive, the Slave's send and our receive
+  uint32_t outbound = slaveReceiveTime - sendTime;
+  uint32_t inbound = receiveTime - (slaveReceiveTime + slaveHoldTime);
+  int32_t roundTrip = (int32_t)(outbound + inbound);
+  if(roundTrip < 0 || roundTrip > (int32_t)microsPerFrame) { return; }  //Echo of a burst from too long ago, or corrupt
+
+  //Any extra delay on one leg, eg our polling, moves the offset by half of it. Samples near the shortest round trip have the least
+  if((uint32_t)roundTrip < peerRoundTrip) { peerRoundTrip = roundTrip; }
+  else { peerRoundTrip++; }
+  if(peerSampleCount > 0 && (uint32_t)roundTrip > peerRoundTrip + TIMESYNC_ROUND_TRIP_SLACK) { return; }
+
+  uint32_t sample = inbound - roundTrip / 2;  //Add to a Slave micros() to get ours, with the two legs taken as equal
+  if(peerSampleCount == 0)
+  {
+    peerOffset = sample;
+    peerDeviation = 0;
+  }
+  else
+  {
+    int32_t error = (int32_t)(sample - peerOffset);
+    peerOffset += error / 8;
+    peerDeviation += ((int32_t)abs(error) - (int32_t)peerDeviation) / 8;
+  }
+  peerSampleCount++;
+  uint32_t uncertainty = peerDeviation * 2 + 1;  //Roughly 2 sigma of the sample jitter
+  peerUncertainty = (uncertainty >= TIMESYNC_INVALID) ? TIMESYNC_INVALID - 1 : uncertainty;
+  peerReportTime = micros();
+}
+
+bool RadioMaster::IsLinkTimeValid()
+{
+  return peerUncertainty != TIMESYNC_INVALID && (micros() - peerReportTime) < 1000000;
+}
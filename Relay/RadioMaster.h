@@ -0,0 +1,251 @@
+#ifndef RadioMaster_h
+#define RadioMaster_h
+
+#include <RF24.h>
+#include "RadioCommon.h"
+#define MAXPACKETS 3
+#define MAXPACKETSIZE 32
+#define PACKET1 0
+#define PACKET2 1
+#define PACKET3 2
+
+typedef void (*RadioReceiveCallback)(uint8_t packetId, void* context);  // Called from the radio task for every new packet
+typedef void (*RadioFillFrameCallback)(void* context);                  // Called from the radio task right before TX
+
+class RadioMaster
+{
+
+protected:
+//Packet buffers, either heap allocated by Init or attached inline by StaticRadioMaster
+  uint8_t* recievePackets[MAXPACKETS] = {nullptr, nullptr, nullptr};
+  uint8_t* sendPackets[MAXPACKETS] = {nullptr, nullptr, nullptr};
+
+private:
+//Radio Stuff
+  RF24 radio;
+  uint8_t channels_Gen[HOP_TABLE_SIZE];  // Generated at runtime by GenerateChannels or copied from a compile time HopTable
+  uint8_t address[2][6];     // Custom dynamic addresses for Master and Slave
+  uint8_t channelsToHop = 40;  // Length of the hop sequence, the first channelsToHop entries of channels_Gen
+  uint8_t framesPerHop = 2;   // Dwell on each channel, 1 hops every frame
+  int8_t currentChannelIndex = 0;
+  uint8_t channelHopCounter = 0;
+  rf24_datarate_e dataRate = RF24_1MBPS;
+
+//Frame Timing Stuff
+  uint16_t frameRate = 0;
+  uint32_t microsPerFrame = 0;
+  uint16_t microsRemainder = 0;  //1000000 % frameRate, spread over the second so the frame rate is exact
+  uint16_t frameRemainder = 0;
+  uint32_t frameTimeEnd = 0;
+  bool isOverFlowFrame = false;
+  uint16_t secondCounter = 0;
+  uint32_t frameCount = 0;
+  uint16_t recievedPacketCount = 0;
+  uint16_t receivedPerSecond = 0;
+  bool isSecondTick = false;
+  uint32_t txStartLatency = 0;          //Micros from frame start until the first bit is on air, CE high plus the TX settling
+  bool isTxReady = false;               //Receive already left RX for the next burst
+  uint32_t txStartLatencyMax = 0;
+  uint32_t txStartLatencyPerSecond = 0;
+  uint32_t replyMicros = 0;             //Frame start until the Slave's whole reply is read, its answer to this frame's burst
+  uint32_t replyMicrosMax = 0;
+  uint32_t replyMicrosPerSecond = 0;
+
+//Radio Task Stuff
+  TaskHandle_t radioTask = nullptr;
+  TaskHandle_t notifyTask = nullptr;
+  RadioReceiveCallback receiveCallback = nullptr;
+  void* receiveCallbackContext = nullptr;
+  RadioFillFrameCallback fillFrameCallback = nullptr;
+  void* fillFrameCallbackContext = nullptr;
+
+//Packet Data
+  uint8_t numberOfSendPackets = 0;
+  uint8_t numberOfReceivePackets = 0;
+  bool receivePacketsAvailable[MAXPACKETS];
+  uint8_t receivePipes[MAXPACKETS];  //Pipe each packet arrived on
+  uint8_t byteAddCounter[MAXPACKETS];
+  uint8_t byteReceiveCounter[MAXPACKETS];
+  uint8_t packetSize = 0;
+  uint8_t headerSize = 1;  //Byte 0 is the packet id and hop counter, optional header fields follow it
+  uint8_t sendHeaderSize[MAXPACKETS];     //headerSize plus fields only carried by one packet id
+  uint8_t receiveHeaderSize[MAXPACKETS];
+
+//Latency Stats Stuff. When enabled bytes 1-2 of every packet carry the age of its data at the sender's frame start
+  bool isLatencyEnabled = false;
+  uint32_t currentFrameStart = 0;
+  uint32_t sendEnqueueTime[MAXPACKETS];
+  bool isSendStamped[MAXPACKETS];
+  LatencyHistogram latencyHistograms[MAXPACKETS];
+
+//Sequence Stuff. When enabled the byte after the latency header carries the sender's frame count
+  bool isSequenceEnabled = false;
+  uint8_t sequenceOffset = 1;
+  SequenceTracker sequenceTrackers[MAXPACKETS];
+  RadioProfiler profiler;  //Only filled when RADIO_PROFILE is defined in RadioCommon.h
+
+//Reply Window Stuff. The Slave replies straight after our burst so its packets arrive in the same frame
+  uint32_t slaveReplyOffset = 0;  //Our first packet going out until the Slave's frame starts
+  uint32_t slaveReplyDelay = 0;   //Slave frames start this long after ours, updated from our actual send time
+  uint32_t slaveBurstMicros = 0;  //Slave frame start until its whole reply is in our RX FIFO
+
+//Link Time Stuff. Link time is our own micros(). The Slave echoes our send time with its own receive and reply times,
+//so the offset comes from both directions of the exchange as in NTP and the radio's delays cancel out
+  bool isTimeSyncEnabled = false;
+  uint32_t peerOffset = 0;                     //Add to a Slave micros() to get link time
+  uint16_t peerUncertainty = TIMESYNC_INVALID;
+  uint32_t peerDeviation = 0;                  //Smoothed absolute error of the offset samples
+  uint32_t peerRoundTrip = TIMESYNC_NO_SAMPLE; //Shortest recent round trip, creeps up 1 us a sample so it follows a slower link
+  uint32_t peerSampleCount = 0;
+  uint32_t peerReportTime = 0;
+
+//Power Control Stuff. Each side reports how well it hears the other in PACKET1 and the other sets its PA level from it
+  bool isPowerControlEnabled = false;
+  uint8_t maxPowerLevel = 0;      //Init's power level, the controller never goes above it
+  uint8_t powerTargetPercent = POWER_DEFAULT_TARGET;
+  LinkQualityCounter linkQuality;
+  PowerController powerController;
+
+  void ClearSendPackets();
+  void ClearReceivePackets();
+  bool ReadNextPacket();
+  void UpdateRecording();
+  void DispatchReceived();
+  void UpdateReplyMicros(uint32_t roundTrip);
+  void UpdateHeaderSizes();
+  void StampEnqueue(uint8_t packetId);
+  uint32_t SlaveFrameStart(uint32_t timeStamp);
+  void WriteTimeSyncHeader(uint8_t* packet);
+  void ReadPeerTimeSync(const uint8_t* packet);
+  void ApplyPowerLevel(bool hasChanged);
+  void WriteLatencyHeader(uint8_t* packet, uint8_t packetId, uint32_t sendStartTime);
+  void RecordLatency(uint8_t packetId, const uint8_t* packet, uint32_t remoteFrameStart);
+  static void RadioTask(void* instance);
+  void UpdateTxStartLatency(uint32_t latency);
+  void AdvanceFrame();
+  bool IsFrameReady();
+
+public:
+  void Init(_SPI* spiPort, uint8_t pinCE, uint8_t PinCS, int8_t powerLevel, uint8_t packetSize, uint8_t numberOfSendPackets, uint8_t numberOfReceivePackets, uint16_t frameRate);
+  void SetAddresses(const char* masterID, const char* slaveID);  // Dynamic address setter
+  bool Bind(LinkParameters& link, uint32_t timeoutMillis);  // Call after Init. Offers fresh addresses and seed on the bind channel until a Slave accepts
+  void UseLink(const LinkParameters& link);  // Addresses and hop table from a bind, call before Init and pass link.frameRate to it
+  void SetHopping(uint8_t channelsToHop, uint8_t framesPerHop);  // Call before Init, must match the Slave. 1 to 126 channels, 1 to 8 frames per channel
+  void SetDataRate(rf24_datarate_e dataRate) {this->dataRate = dataRate; }  // Call before Init, must match the Slave. RF24_2MBPS allows the highest frame rates
+  uint16_t GetFrameRate() {return frameRate; }  // Frame rate after Init clamped it
+  void AlignFrame(uint32_t frameStart);  // Starts the next frame at frameStart instead of on our own clock, eg to follow another link
+  void RandomiseFramePhase();  // Call after Init. Moves the frame start to a random point so pairs switched on together don't all send at once
+  void WaitAndSend();
+  void Receive();
+  bool IsNewPacket(uint8_t packetId) {return receivePacketsAvailable[packetId]; }
+  uint8_t GetReceivePipe(uint8_t packetId) {return receivePipes[packetId]; }
+  int16_t GetRecievedPacketsPerSecond() {return receivedPerSecond; }
+  int8_t GetCurrentChannel() { return channels_Gen[currentChannelIndex]; }
+  bool IsSecondTick() {return isSecondTick; }
+  uint32_t GetTxStartLatencyMicros() {return txStartLatency; }
+  uint32_t GetMaxTxStartLatencyMicros() {return txStartLatencyPerSecond; }  //Worst case over the last second
+  uint32_t GetReplyMicros() {return replyMicros; }  //Request/response round trip, the Slave's fill callback has already seen this frame's burst
+  uint32_t GetMaxReplyMicros() {return replyMicrosPerSecond; }
+  bool StartTask(BaseType_t core = 1, UBaseType_t priority = configMAX_PRIORITIES - 2, uint32_t stackSize = 4096);  // Runs WaitAndSend/Receive on its own pinned task
+  void OnReceive(RadioReceiveCallback callback, void* context = nullptr) {receiveCallback = callback; receiveCallbackContext = context; }
+  void OnFillFrame(RadioFillFrameCallback callback, void* context = nullptr) {fillFrameCallback = callback; fillFrameCallbackContext = context; }
+  void SetNotifyTask(TaskHandle_t task) {notifyTask = task; }  // Task is notified with xTaskNotifyGive after every frame's Receive
+  void EnableLatencyStats();  //Must be enabled on both Master and Slave. Uses 2 bytes of every packet
+  void ResetLatencyStats();
+  uint32_t GetLatencyPercentileMicros(uint8_t packetId, uint8_t percent);  //Enqueue on the sender to delivery here, eg percent 50 or 99
+  uint32_t GetMaxLatencyMicros(uint8_t packetId);
+  void EnableSequenceNumbers();  //Must be enabled on both Master and Slave. Uses 1 byte of every packet, late and duplicate packets are dropped
+  void ResetSequenceStats();
+  SequenceStats GetSequenceStats(uint8_t packetId);  //Exact received, lost and duplicate counts and gap lengths per packet id
+  void EnableTimeSync();  //Must be enabled on both Master and Slave. Uses 10 bytes of our PACKET1 and 12 bytes of the Slave's
+  uint32_t GetLinkTime() {return micros(); }
+  uint32_t LocalToLinkTime(uint32_t localMicros) {return localMicros; }
+  uint32_t LinkToLocalTime(uint32_t linkMicros) {return linkMicros; }
+  uint32_t PeerToLinkTime(uint32_t slaveMicros) {return slaveMicros + peerOffset; }  //Converts a micros() value taken on the Slave
+  bool IsLinkTimeValid();
+  uint16_t GetLinkTimeUncertaintyMicros() {return IsLinkTimeValid() ? peerUncertainty : TIMESYNC_INVALID; }
+  uint32_t GetLinkRoundTripMicros() {return peerRoundTrip; }  //Our send time to the Slave's reply being read, less the time the Slave held it
+  void EnablePowerControl(uint8_t targetPercent = POWER_DEFAULT_TARGET);  //Must be enabled on both Master and Slave. Uses 3 bytes of PACKET1 each way, Init's power level becomes the maximum
+  uint8_t GetPowerLevel() {return powerController.GetLevel(); }
+  uint16_t GetPowerChanges() {return powerController.GetChanges(); }
+  uint8_t GetPeerDeliveryPercent() {return powerController.GetPeerDeliveryPercent(); }  //How much of what we send the peer last reported getting
+  ProfileStats GetProfile(uint8_t phase) {return profiler.Get(phase); }  //Cycles per PROFILE_ phase, divide by RadioCyclesPerMicro() for micros
+  void ResetProfile() {profiler.Reset(); }
+  template <typename T> void AddNextPacketValue(uint8_t packetId, T data);
+  template <typename T> T GetNextPacketValue(uint8_t packetId);
+  uint8_t GetReceivedPayload(uint8_t packetId, uint8_t* buffer);  //Copies a received packet minus its header, returns the length. eg for forwarding it on
+  void SetSendPayload(uint8_t packetId, const uint8_t* payload, uint8_t length);  //Fills a packet in one go instead of value by value
+  void GenerateChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t seed);
+  void SetChannels(const HopTable& table);  // Same sequence as GenerateChannels with the table's arguments
+  void GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound);  // Sequence from the addresses, call after SetAddresses and SetHopping. Sets the hop length
+  void GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t pairNumber);  // Pair numbers 0 and up never share a slope
+  void GenerateChannelsFromList(const uint8_t* channels, uint8_t count, uint32_t seed);  // Hops over just these channels, eg from SpectrumSurvey::GetCleanChannels
+  void SurveySpectrum(SpectrumSurvey& survey, uint16_t sweeps, uint16_t dwellMicros = SURVEY_DEFAULT_DWELL_MICROS);  // Blocks, call after Init and before StartTask
+};
+
+
+template <typename T>
+void RadioMaster::AddNextPacketValue(uint8_t packetId, T data) 
+{
+    size_t dataLength = sizeof(T);
+    if (packetId >= MAXPACKETS) 
+    {
+        return;
+    }
+
+    if (byteAddCounter[packetId] + dataLength > packetSize) 
+    {
+      return;
+    }
+
+    if(byteAddCounter[packetId] == sendHeaderSize[packetId]) { StampEnqueue(packetId); }
+
+    memcpy(&sendPackets[packetId][byteAddCounter[packetId]], &data, dataLength);
+
+    byteAddCounter[packetId] += dataLength;
+}
+
+template <typename T>
+T RadioMaster::GetNextPacketValue(uint8_t packetId) 
+{
+
+    size_t dataLength = sizeof(T);
+
+    if (packetId >= MAXPACKETS) {
+        return 0;
+    }
+
+    if (byteReceiveCounter[packetId] + dataLength > packetSize) 
+    {
+        return 0;
+    }
+
+    T value;
+    memcpy(&value, &recievePackets[packetId][byteReceiveCounter[packetId]], dataLength);
+    byteReceiveCounter[packetId] += dataLength;
+    return value;
+}
+
+// Heap free variant. Packet size and counts are fixed at compile time and every buffer lives
+// inside the object, so RAM use shows up in the linker map and Init never touches the heap.
+// eg. StaticRadioMaster<32, 2, 2> radio;
+template <uint8_t PacketSize, uint8_t SendPackets, uint8_t ReceivePackets>
+class StaticRadioMaster : public RadioMaster
+{
+  static_assert(PacketSize >= 1 && PacketSize <= MAXPACKETSIZE, "PacketSize must be between 1 and 32");
+  static_assert(SendPackets <= MAXPACKETS && ReceivePackets <= MAXPACKETS, "A maximum of 3 packets per frame");
+
+private:
+  uint8_t sendStorage[SendPackets > 0 ? SendPackets : 1][PacketSize];
+  uint8_t receiveStorage[ReceivePackets > 0 ? ReceivePackets : 1][PacketSize];
+
+public:
+  void Init(_SPI* spiPort, uint8_t pinCE, uint8_t PinCS, int8_t powerLevel, uint16_t frameRate)
+  {
+    for(uint8_t i = 0; i < SendPackets; i++) { sendPackets[i] = sendStorage[i]; }
+    for(uint8_t i = 0; i < ReceivePackets; i++) { recievePackets[i] = receiveStorage[i]; }
+    RadioMaster::Init(spiPort, pinCE, PinCS, powerLevel, PacketSize, SendPackets, ReceivePackets, frameRate);
+  }
+};
+
+#endif
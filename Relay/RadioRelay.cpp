@@ -0,0 +1,141 @@
+#include "RadioRelay.h"
+
+void RadioRelay::Begin(RadioSlave* upstream, RadioMaster* downstream, uint8_t forwardDownMask, uint8_t forwardUpMask)
+{
+  this->upstream = upstream;
+  this->downstream = downstream;
+  forwardMask[RELAY_DOWNSTREAM] = forwardDownMask;
+  forwardMask[RELAY_UPSTREAM] = forwardUpMask;
+  memset(isStaged, 0, sizeof(isStaged));
+  memset(isForwarded, 0, sizeof(isForwarded));
+
+  upstream->OnReceive(UpstreamReceived, this);
+  upstream->OnFillFrame(FillUpstream, this);
+  downstream->OnReceive(DownstreamReceived, this);
+  downstream->OnFillFrame(FillDownstream, this);
+  ResetLatencyStats();
+}
+
+bool RadioRelay::StartTask(BaseType_t core, UBaseType_t priority, uint32_t stackSize)
+{
+  if(relayTask != nullptr || upstream == nullptr) { return false; }
+  return xTaskCreatePinnedToCore(RelayTask, "RadioRelay", stackSize, this, priority, &relayTask, core) == pdPASS;
+}
+
+void RadioRelay::RelayTask(void* instance)
+{
+  RadioRelay* self = static_cast<RadioRelay*>(instance);
+  while(true)
+  {
+    self->RunFrame();
+  }
+}
+
+void RadioRelay::RunFrame()
+{
+  //Our frame clock follows the upstream Master through the Slave's IRQ sync. The downstream exchange runs
+  //from the upstream fill callback, after the Master's burst is read and before our reply to it is sent
+  upstream->WaitAndSend();
+  if(upstream->GetRadioState() == STATE_FULL_LOCK) { RecordSent(RELAY_UPSTREAM); }  //Only sent in full lock, otherwise it waits for the next frame
+  upstream->Receive();
+
+  if(upstream->IsSecondTick())
+  {
+    for(int i = 0; i < RELAY_DIRECTIONS; i++)
+    {
+      forwardedPerSecond[i] = forwardedCount[i];
+      forwardedCount[i] = 0;
+    }
+  }
+
+  if(notifyTask != nullptr) { xTaskNotifyGive(notifyTask); }
+}
+
+template <class Radio>
+void RadioRelay::Stage(uint8_t direction, Radio* source, uint8_t packetId)
+{
+  if(!(forwardMask[direction] & (1 << packetId))) { return; }
+  stagedLength[direction][packetId] = source->GetReceivedPayload(packetId, stagedPayload[direction][packetId]);
+  stagedTime[direction][packetId] = micros();
+  isStaged[direction][packetId] = true;
+}
+
+void RadioRelay::RunDownstream()
+{
+  //Starts the downstream frame now, so whatever just came down goes straight out and the downstream
+  //Slave's reply is in before we fill our own reply upstream
+  downstream->AlignFrame(micros());
+  downstream->WaitAndSend();
+  RecordSent(RELAY_DOWNSTREAM);
+  downstream->Receive();
+}
+
+template <class Radio>
+void RadioRelay::Forward(uint8_t direction, Radio* destination)
+{
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    if(!isStaged[direction][i]) { continue; }
+    destination->SetSendPayload(i, stagedPayload[direction][i], stagedLength[direction][i]);
+    isForwarded[direction][i] = true;
+    isStaged[direction][i] = false;
+  }
+}
+
+void RadioRelay::RecordSent(uint8_t direction)
+{
+  uint32_t sentTime = micros();
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    if(!isForwarded[direction][i]) { continue; }
+    forwardLatency[direction].Add(sentTime - stagedTime[direction][i]);
+    forwardedCount[direction]++;
+    isForwarded[direction][i] = false;
+  }
+}
+
+void RadioRelay::UpstreamReceived(uint8_t packetId, void* context)
+{
+  RadioRelay* self = static_cast<RadioRelay*>(context);
+  self->Stage(RELAY_DOWNSTREAM, self->upstream, packetId);
+}
+
+void RadioRelay::DownstreamReceived(uint8_t packetId, void* context)
+{
+  RadioRelay* self = static_cast<RadioRelay*>(context);
+  self->Stage(RELAY_UPSTREAM, self->downstream, packetId);
+}
+
+void RadioRelay::FillUpstream(void* context)
+{
+  RadioRelay* self = static_cast<RadioRelay*>(context);
+  self->RunDownstream();
+  self->Forward(RELAY_UPSTREAM, self->upstream);
+}
+
+void RadioRelay::FillDownstream(void* context)
+{
+  RadioRelay* self = static_cast<RadioRelay*>(context);
+  self->Forward(RELAY_DOWNSTREAM, self->downstream);
+}
+
+void RadioRelay::ResetLatencyStats()
+{
+  uint32_t microsPerFrame = 1000000 / upstream->GetFrameRate();
+  for(int i = 0; i < RELAY_DIRECTIONS; i++)
+  {
+    forwardLatency[i].Reset(microsPerFrame / 16);
+  }
+}
+
+uint32_t RadioRelay::GetForwardLatencyPercentileMicros(uint8_t direction, uint8_t percent)
+{
+  if(direction >= RELAY_DIRECTIONS) { return 0; }
+  return forwardLatency[direction].Percentile(percent);
+}
+
+uint32_t RadioRelay::GetMaxForwardLatencyMicros(uint8_t direction)
+{
+  if(direction >= RELAY_DIRECTIONS) { return 0; }
+  return forwardLatency[direction].GetMax();
+}
@@ -0,0 +1,59 @@
+#ifndef RadioRelay_h
+#define RadioRelay_h
+
+#include "RadioSlave.h"
+#include "RadioMaster.h"
+
+#define RELAY_DOWNSTREAM 0  // Upstream Master to downstream Slave
+#define RELAY_UPSTREAM 1    // Downstream Slave back to the upstream Master
+#define RELAY_DIRECTIONS 2
+
+// Range extender. Acts as a Slave towards the upstream Master and as a Master towards a downstream Slave,
+// forwarding the chosen packet ids each way. The whole downstream exchange runs between reading the upstream
+// Master's burst and sending our reply to it, so packets go through in the same frame both ways.
+class RadioRelay
+{
+private:
+  RadioSlave* upstream = nullptr;
+  RadioMaster* downstream = nullptr;
+  uint8_t forwardMask[RELAY_DIRECTIONS] = {0, 0};  //Bit per packet id
+
+//Packets held until the other link's next send
+  uint8_t stagedPayload[RELAY_DIRECTIONS][MAXPACKETS][MAXPACKETSIZE];
+  uint8_t stagedLength[RELAY_DIRECTIONS][MAXPACKETS];
+  uint32_t stagedTime[RELAY_DIRECTIONS][MAXPACKETS];
+  bool isStaged[RELAY_DIRECTIONS][MAXPACKETS];
+  bool isForwarded[RELAY_DIRECTIONS][MAXPACKETS];  //Handed to the other link, counted once its burst has gone out
+
+//Forwarding Stats. Time a packet spends in the relay from being received to the other link's burst carrying it being sent
+  LatencyHistogram forwardLatency[RELAY_DIRECTIONS];
+  uint16_t forwardedCount[RELAY_DIRECTIONS] = {0, 0};
+  uint16_t forwardedPerSecond[RELAY_DIRECTIONS] = {0, 0};
+
+//Relay Task Stuff
+  TaskHandle_t relayTask = nullptr;
+  TaskHandle_t notifyTask = nullptr;
+
+  template <class Radio> void Stage(uint8_t direction, Radio* source, uint8_t packetId);
+  template <class Radio> void Forward(uint8_t direction, Radio* destination);
+  void RecordSent(uint8_t direction);
+  static void UpstreamReceived(uint8_t packetId, void* context);
+  static void DownstreamReceived(uint8_t packetId, void* context);
+  static void FillUpstream(void* context);
+  static void FillDownstream(void* context);
+  static void RelayTask(void* instance);
+  void RunFrame();
+  void RunDownstream();
+
+public:
+  void Begin(RadioSlave* upstream, RadioMaster* downstream, uint8_t forwardDownMask, uint8_t forwardUpMask);  //Both radios must already be Init'd at the same frame rate
+  bool StartTask(BaseType_t core = 1, UBaseType_t priority = configMAX_PRIORITIES - 2, uint32_t stackSize = 4096);  // Runs both links on one pinned task, don't StartTask the radios themselves
+  void SetNotifyTask(TaskHandle_t task) {notifyTask = task; }  // Task is notified with xTaskNotifyGive after every frame
+  bool IsSecondTick() {return upstream->IsSecondTick(); }
+  uint16_t GetForwardedPerSecond(uint8_t direction) {return (direction < RELAY_DIRECTIONS) ? forwardedPerSecond[direction] : 0; }
+  void ResetLatencyStats();
+  uint32_t GetForwardLatencyPercentileMicros(uint8_t direction, uint8_t percent);  //RELAY_DOWNSTREAM or RELAY_UPSTREAM, eg percent 50 or 99
+  uint32_t GetMaxForwardLatencyMicros(uint8_t direction);
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef RadioSlave_h
+#define RadioSlave_h
+
+#include <RF24.h>
+#include "RadioCommon.h"
+#define MAXPACKETS 3
+#define MAXPACKETSIZE 32
+#define PACKET1 0
+#define PACKET2 1
+#define PACKET3 2
+
+typedef void (*RadioReceiveCallback)(uint8_t packetId, void* context);  // Called from the radio task for every new packet
+typedef void (*RadioFillFrameCallback)(void* context);                  // Called from the radio task right before TX, after this frame's packets are received
+
+#define STATE_SCANNING 0
+#define STATE_PARTIAL_LOCK 1
+#define STATE_FULL_LOCK 2
+#define STATE_COASTING 3   // Lost the Master but still hopping on its predicted schedule, one packet relocks
+
+#define SCAN_PREDICTED_EVERY 4   // While scanning, one frame in this many listens where the Master is predicted to be
+
+class RadioSlave
+{
+protected:
+//Packet buffers, either heap allocated by Init or attached inline by StaticRadioSlave
+  uint8_t* recievePackets[MAXPACKETS] = {nullptr, nullptr, nullptr};
+  uint8_t* sendPackets[MAXPACKETS] = {nullptr, nullptr, nullptr};
+
+private:
+//Radio Stuff
+  RF24 radio;
+  int8_t powerLevel = 0;
+  uint8_t channels_Gen[HOP_TABLE_SIZE];  // Generated at runtime by GenerateChannels or copied from a compile time HopTable
+  uint8_t address[2][6];     // Custom dynamic addresses for Master and Slave
+  uint8_t channelsToHop = 40;  // Length of the hop sequence, the first channelsToHop entries of channels_Gen
+  uint8_t framesPerHop = 2;   // Dwell on each channel, 1 hops every frame
+  int8_t currentChannelIndex = 0;
+  uint8_t channelHopCounter = 0;
+  uint8_t hopOnLockValue = 1;  // framesPerHop - 1
+  int8_t scanPredictedIndex = 0;  // Where the Master would be if it kept the schedule we last had
+  uint8_t scanOffset = 0;          // Sweep position, channels from scanPredictedIndex
+  uint8_t scanFrame = 0;
+  uint16_t failedCounter = 0;
+  uint16_t failedBeforeScanning = 50;  //Frames without a packet before scanning again, a quarter second at high frame rates
+  rf24_datarate_e dataRate = RF24_1MBPS;
+
+//Frame Timing Stuff
+  uint16_t frameRate = 0;
+  uint32_t microsPerFrame = 0;
+  volatile uint32_t halfMicrosPerFrame = 0;
+  uint32_t frameTimeEnd = 0;
+  bool isOverFlowFrame = false;
+  uint16_t secondCounter = 0;
+  uint32_t frameCount = 0;
+  uint16_t recievedPacketCount = 0;
+  uint16_t sentPacketCount = 0;
+  uint16_t receivedPerSecond = 0;
+  uint16_t sentPerSecond = 0;
+  bool isSecondTick = false;
+  uint32_t txStartLatency = 0;          //Micros from frame start until the first bit is on air, CE high plus the TX settling
+  uint32_t txStartLatencyMax = 0;
+  uint32_t txStartLatencyPerSecond = 0;
+
+//Radio Task Stuff
+  TaskHandle_t radioTask = nullptr;
+  TaskHandle_t notifyTask = nullptr;
+  RadioReceiveCallback receiveCallback = nullptr;
+  void* receiveCallbackContext = nullptr;
+  RadioFillFrameCallback fillFrameCallback = nullptr;
+  void* fillFrameCallbackContext = nullptr;
+
+//Packet Data
+  uint8_t numberOfSendPackets = 0;
+  uint8_t numberOfReceivePackets = 0;
+  bool receivePacketsAvailable[MAXPACKETS];
+  uint8_t receivePipes[MAXPACKETS];  //Pipe each packet arrived on
+  uint8_t byteAddCounter[MAXPACKETS];
+  uint8_t byteReceiveCounter[MAXPACKETS];
+  uint8_t packetSize = 0;
+  uint8_t headerSize = 1;  //Byte 0 is the packet id and hop counter, optional header fields follow it
+  uint8_t sendHeaderSize[MAXPACKETS];     //headerSize plus fields only carried by one packet id
+  uint8_t receiveHeaderSize[MAXPACKETS];
+
+//Latency Stats Stuff. When enabled bytes 1-2 of every packet carry the age of its data at the sender's frame start
+  bool isLatencyEnabled = false;
+  uint32_t currentFrameStart = 0;
+  uint32_t sendEnqueueTime[MAXPACKETS];
+  bool isSendStamped[MAXPACKETS];
+  LatencyHistogram latencyHistograms[MAXPACKETS];
+
+//Sequence Stuff. When enabled the byte after the latency header carries the sender's frame count
+  bool isSequenceEnabled = false;
+  uint8_t sequenceOffset = 1;
+  SequenceTracker sequenceTrackers[MAXPACKETS];
+  RadioProfiler profiler;  //Only filled when RADIO_PROFILE is defined in RadioCommon.h
+
+//Diversity Stuff. A second radio follows the same hops, packets from either are merged and the better one transmits
+  bool isDiversityEnabled = false;
+  RF24 diversityRadio;
+  uint8_t txRadioIndex = 0;
+  uint32_t linkHistory[DIVERSITY_RADIOS] = {0, 0};  //One bit per frame, set when that radio received anything
+  uint16_t diversityReceivedCount[DIVERSITY_RADIOS] = {0, 0};
+  uint16_t diversityReceivedPerSecond[DIVERSITY_RADIOS] = {0, 0};
+
+//Link Time Stuff. Link time is the Master's micros(). We echo its send time in PACKET1 with our IRQ time stamp for it
+//and our reply time, the Master works out our offset from both directions and sends it back in its next PACKET1
+  bool isTimeSyncEnabled = false;
+  uint32_t txPipelineMicros = 0;  //Master's burst start to our IRQ for its first packet, modelled
+  uint32_t linkOffset = 0;        //Add to our micros() to get link time
+  uint16_t linkUncertainty = TIMESYNC_INVALID;
+  uint32_t linkSampleTime = 0;
+  uint32_t masterSendTime = 0;    //Last PACKET1 from the Master, echoed in our reply
+  uint32_t masterReceiveTime = 0;
+  bool hasMasterSendTime = false;
+
+//Power Control Stuff. Each side reports how well it hears the other in PACKET1 and the other sets its PA level from it
+  bool isPowerControlEnabled = false;
+  uint8_t maxPowerLevel = 0;      //Init's power level, the controller never goes above it
+  uint8_t powerTargetPercent = POWER_DEFAULT_TARGET;
+  LinkQualityCounter linkQuality;
+  PowerController powerController;
+
+//Low Power Stuff. In full lock the radio sits in standby except for a window before the Master's burst and our reply
+  bool isLowPowerEnabled = false;
+  bool isLightSleepEnabled = false;
+  uint16_t lowPowerGuardMicros = LOWPOWER_DEFAULT_GUARD_MICROS;
+  bool isRadioAsleep = false;
+  uint32_t radioSleepStart = 0;
+  uint32_t radioSleepMicros = 0;   //Time in standby this second
+  uint32_t secondStartTime = 0;
+  uint16_t radioDutyPermille = 1000;
+
+//Radio Interrupt Stuff
+  int16_t totalAdjustedDrift = 0;  //Take this out
+  uint32_t warmMicrosPerFrame = 0;  //Frame time from a stored link, 0 for none
+  uint32_t lastFrameTimeSave = 0;  //millis() of StoreFrameTime's last write
+  bool isBurstReceived = false;  //ReadBurst heard the Master this frame, Receive tracks the lock with it
+  uint32_t syncDelay = 0;  //IRQ to our frame start, just long enough for the Master to finish its burst and start listening
+  uint32_t burstSlotMicros = 0;  //Master's packets land this far apart, so a later packet's IRQ can be moved back to PACKET1's
+  uint32_t minOverflowProtection;
+  uint32_t maxOverflowProtection;
+  uint8_t partialLockCounter = 0;
+  volatile uint8_t radioState = STATE_SCANNING;
+
+//Coast Stuff. Time from losing lock to getting it back is averaged to compare coasting against scanning straight away
+  uint32_t coastMicros = 0;  //Off unless SetCoastTime is called, the Slave goes straight back to scanning as it always has
+  uint32_t coastStartTime = 0;
+  bool isOutage = false;
+  uint32_t outageStartTime = 0;
+  uint32_t recoveryTotalMicros = 0;
+  uint16_t recoveryCount = 0;
+  uint32_t lastRecoveryMicros = 0;
+  volatile bool isSyncFrame = false;
+  volatile uint32_t interruptTimeStamp = 0;
+  volatile uint32_t irqTimeStamps[DIVERSITY_RADIOS] = {0, 0};      //Raw micros() of each radio's IRQ for the burst
+  volatile uint32_t lastIrqTimeStamps[DIVERSITY_RADIOS] = {0, 0};
+  volatile bool isIrqPending[DIVERSITY_RADIOS] = {false, false};  //IRQ not yet matched to the packet that raised it
+  uint32_t syncSampleBase = 0;  //Sync samples of this frame, summed as offsets from the first
+  int32_t syncSampleSum = 0;
+  uint8_t syncSampleCount = 0;
+  volatile uint32_t syncIrqTimeStamp = 0;  //When PACKET1 of the last burst landed, corrected from whichever packet raised the IRQ
+  volatile int8_t syncChannelIndex = 0;    //Channel index we were listening on at that IRQ
+
+  void ClearSendPackets();
+  void ClearReceivePackets();
+  void ConfigureRadio(RF24& target, _SPI* spiPort, uint8_t pinCE, uint8_t pinCS);
+  RF24& GetRadio(uint8_t radioIndex) {return (radioIndex == 0) ? radio : diversityRadio; }
+  void StartListening();
+  void StopListening();
+  void ReadBurst();
+  bool ReadRadio(uint8_t radioIndex);
+  void UpdateTxRadio();
+  void UpdateScanning(bool isSuccess);
+  void SetRadioState(uint8_t newState);
+  void StartScan();
+  void UpdateSecondCounter();
+  void DispatchReceived();
+  void UpdateHeaderSizes();
+  void StampEnqueue(uint8_t packetId);
+  void WriteLatencyHeader(uint8_t* packet, uint8_t packetId);
+  void RecordLatency(uint8_t packetId, const uint8_t* packet, uint32_t remoteFrameStart);
+  void ReadMasterTimeSync(const uint8_t* packet);
+  void WriteTimeSyncHeader(uint8_t* packet);
+  void ApplyPowerLevel(bool hasChanged);
+  static void RadioTask(void* instance);
+  void UpdateTxStartLatency(uint32_t latency);
+  void SetNextFrameEnd(uint32_t newTime);
+  void AdvanceFrame();
+  bool IsFrameReady();
+  void AdjustChannelIndex(int8_t amount);
+  bool UpdateHop();
+  void SleepRadio();
+  void WaitForListenWindow();
+  void WakeRadio();
+  static void StaticIRQHandler(void* instance);
+  static void StaticDiversityIRQHandler(void* instance);
+  void IRQHandler(uint8_t radioIndex);
+  void AddSyncSample(uint32_t burstStart);
+
+public:
+  void Init(_SPI* spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ, int8_t powerLevel, uint8_t packetSize, uint8_t numberOfSendPackets, uint8_t numberOfReceivePackets, uint16_t frameRate);
+  void InitDiversity(_SPI* spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ);  // Optional second NRF24 for receive diversity, call after Init
+  void SetAddresses(const char* masterID, const char* slaveID);  // Dynamic address setter
+  bool Bind(LinkParameters& link, uint32_t timeoutMillis);  // Call after Init. Waits on the bind channel for a Master's offer and accepts the first one
+  void UseLink(const LinkParameters& link);  // Addresses, hop table and stored frame time, call before Init and pass link.frameRate to it
+  bool StoreFrameTime(LinkStorage& storage, LinkParameters& link);  // Saves the tracked frame time while in full lock, for a warm start next power on
+  void SetHopping(uint8_t channelsToHop, uint8_t framesPerHop);  // Call before Init, must match the Master. 1 to 126 channels, 1 to 8 frames per channel
+  void SetDataRate(rf24_datarate_e dataRate) {this->dataRate = dataRate; }  // Call before Init, must match the Master. RF24_2MBPS allows the highest frame rates
+  uint16_t GetFrameRate() {return frameRate; }  // Frame rate after Init clamped it
+  void WaitAndSend();
+  void Receive();
+  bool IsNewPacket(uint8_t packetId) {return receivePacketsAvailable[packetId]; }
+  uint8_t GetReceivePipe(uint8_t packetId) {return receivePipes[packetId]; }
+  uint16_t GetRecievedPacketsPerSecond() {return receivedPerSecond; }
+  uint16_t GetDiversityReceivedPerSecond(uint8_t radioIndex) {return (radioIndex < DIVERSITY_RADIOS) ? diversityReceivedPerSecond[radioIndex] : 0; }  //Packets each radio heard, before duplicates are removed
+  uint8_t GetTxRadioIndex() {return txRadioIndex; }
+  uint8_t GetRadioState() {return radioState; }
+  void SetCoastTime(uint16_t millis) {coastMicros = (uint32_t)millis * 1000; }  // How long to keep hopping blind after losing the Master, 0 goes straight back to scanning
+  uint32_t GetLastRecoveryMicros() {return lastRecoveryMicros; }  // Losing lock to full lock again
+  uint32_t GetAverageRecoveryMicros() {return (recoveryCount > 0) ? recoveryTotalMicros / recoveryCount : 0; }
+  uint16_t GetRecoveryCount() {return recoveryCount; }
+  int16_t GetDriftAdjustmentMicros() { return totalAdjustedDrift; }
+  int8_t GetCurrentChannel() { return channels_Gen[currentChannelIndex]; }
+  bool IsSecondTick() {return isSecondTick; }
+  uint32_t GetTxStartLatencyMicros() {return txStartLatency; }
+  uint32_t GetMaxTxStartLatencyMicros() {return txStartLatencyPerSecond; }  //Worst case over the last second
+  void EnableLowPower(uint16_t guardMicros = LOWPOWER_DEFAULT_GUARD_MICROS, bool useLightSleep = false);  // Radio in standby between our reply and the next burst while in full lock
+  void DisableLowPower() {isLowPowerEnabled = false; }
+  uint16_t GetRadioDutyPermille() {return radioDutyPermille; }  // Per 1000 of the last second the radio was listening or sending
+  bool StartTask(BaseType_t core = 1, UBaseType_t priority = configMAX_PRIORITIES - 2, uint32_t stackSize = 4096);  // Runs WaitAndSend/Receive on its own pinned task
+  void OnReceive(RadioReceiveCallback callback, void* context = nullptr) {receiveCallback = callback; receiveCallbackContext = context; }
+  void OnFillFrame(RadioFillFrameCallback callback, void* context = nullptr) {fillFrameCallback = callback; fillFrameCallbackContext = context; }
+  void SetNotifyTask(TaskHandle_t task) {notifyTask = task; }  // Task is notified with xTaskNotifyGive after every frame's Receive
+  void EnableLatencyStats();  //Must be enabled on both Master and Slave. Uses 2 bytes of every packet
+  void ResetLatencyStats();
+  uint32_t GetLatencyPercentileMicros(uint8_t packetId, uint8_t percent);  //Enqueue on the sender to delivery here, eg percent 50 or 99
+  uint32_t GetMaxLatencyMicros(uint8_t packetId);
+  void EnableSequenceNumbers();  //Must be enabled on both Master and Slave. Uses 1 byte of every packet, late and duplicate packets are dropped
+  void ResetSequenceStats();
+  SequenceStats GetSequenceStats(uint8_t packetId);  //Exact received, lost and duplicate counts and gap lengths per packet id
+  void EnableTimeSync();  //Must be enabled on both Master and Slave. Uses 10 bytes of the Master's PACKET1 and 12 bytes of ours
+  uint32_t GetLinkTime() {return micros() + linkOffset; }
+  uint32_t LocalToLinkTime(uint32_t localMicros) {return localMicros + linkOffset; }
+  uint32_t LinkToLocalTime(uint32_t linkMicros) {return linkMicros - linkOffset; }
+  bool IsLinkTimeValid();
+  uint16_t GetLinkTimeUncertaintyMicros();
+  void EnablePowerControl(uint8_t targetPercent = POWER_DEFAULT_TARGET);  //Must be enabled on both Master and Slave. Uses 3 bytes of PACKET1 each way, Init's power level becomes the maximum
+  uint8_t GetPowerLevel() {return powerController.GetLevel(); }
+  uint16_t GetPowerChanges() {return powerController.GetChanges(); }
+  uint8_t GetPeerDeliveryPercent() {return powerController.GetPeerDeliveryPercent(); }  //How much of what we send the peer last reported getting
+  ProfileStats GetProfile(uint8_t phase) {return profiler.Get(phase); }  //Cycles per PROFILE_ phase, divide by RadioCyclesPerMicro() for micros
+  void ResetProfile() {profiler.Reset(); }
+  template <typename T> void AddNextPacketValue(uint8_t packetId, T data);
+  template <typename T> T GetNextPacketValue(uint8_t packetId);
+  uint8_t GetReceivedPayload(uint8_t packetId, uint8_t* buffer);  //Copies a received packet minus its header, returns the length. eg for forwarding it on
+  void SetSendPayload(uint8_t packetId, const uint8_t* payload, uint8_t length);  //Fills a packet in one go instead of value by value
+  void GenerateChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t seed);
+  void SetChannels(const HopTable& table);  // Same sequence as GenerateChannels with the table's arguments
+  void GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound);  // Sequence from the addresses, call after SetAddresses and SetHopping. Sets the hop length
+  void GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t pairNumber);  // Pair numbers 0 and up never share a slope
+  void GenerateChannelsFromList(const uint8_t* channels, uint8_t count, uint32_t seed);  // Hops over just these channels, eg from SpectrumSurvey::GetCleanChannels
+  void SurveySpectrum(SpectrumSurvey& survey, uint16_t sweeps, uint16_t dwellMicros = SURVEY_DEFAULT_DWELL_MICROS);  // Blocks, call after Init and before StartTask
+};
+
+
+template <typename T>
+void RadioSlave::AddNextPacketValue(uint8_t packetId, T data) 
+{
+    size_t dataLength = sizeof(T);
+
+    if (packetId >= MAXPACKETS) 
+    {
+        return;
+    }
+
+    if (byteAddCounter[packetId] + dataLength > packetSize) 
+    {
+      return;
+    }
+
+    if(byteAddCounter[packetId] == sendHeaderSize[packetId]) { StampEnqueue(packetId); }
+
+    memcpy(&sendPackets[packetId][byteAddCounter[packetId]], &data, dataLength);
+
+    byteAddCounter[packetId] += dataLength;
+}
+
+template <typename T>
+T RadioSlave::GetNextPacketValue(uint8_t packetId) 
+{
+    
+    size_t dataLength = sizeof(T);
+
+    if (packetId >= MAXPACKETS) {
+        return 0;
+    }
+
+    if (byteReceiveCounter[packetId] + dataLength > packetSize) 
+    {
+        return 0;
+    }
+
+    T value;
+    memcpy(&value, &recievePackets[packetId][byteReceiveCounter[packetId]], dataLength);
+    byteReceiveCounter[packetId] += dataLength;
+    return value;
+}
+
+// Heap free variant. Packet size and counts are fixed at compile time and every buffer lives
+// inside the object, so RAM use shows up in the linker map and Init never touches the heap.
+// eg. StaticRadioSlave<32, 2, 2> radio;
+template <uint8_t PacketSize, uint8_t SendPackets, uint8_t ReceivePackets>
+class StaticRadioSlave : public RadioSlave
+{
+  static_assert(PacketSize >= 1 && PacketSize <= MAXPACKETSIZE, "PacketSize must be between 1 and 32");
+  static_assert(SendPackets <= MAXPACKETS && ReceivePackets <= MAXPACKETS, "A maximum of 3 packets per frame");
+
+private:
+  uint8_t sendStorage[SendPackets > 0 ? SendPackets : 1][PacketSize];
+  uint8_t receiveStorage[ReceivePackets > 0 ? ReceivePackets : 1][PacketSize];
+
+public:
+  void Init(_SPI* spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ, int8_t powerLevel, uint16_t frameRate)
+  {
+    for(uint8_t i = 0; i < SendPackets; i++) { sendPackets[i] = sendStorage[i]; }
+    for(uint8_t i = 0; i < ReceivePackets; i++) { recievePackets[i] = receiveStorage[i]; }
+    RadioSlave::Init(spiPort, pinCE, pinCS, pinIRQ, powerLevel, PacketSize, SendPackets, ReceivePackets, frameRate);
+  }
+};
+
+#endif
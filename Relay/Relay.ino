@@ -0,0 +1,62 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include "RadioRelay.h"
+
+// Range extender between the Master and Slave examples. Towards the Master this node is a Slave on the usual
+// addresses and channels, towards a second Slave further away it is a Master on its own addresses and channels.
+// PACKET1 is passed on in both directions. The downstream Slave needs SetAddresses("UST02", "ALT02") and
+// GenerateChannels(76, 124, 54321) so the two links don't hear each other.
+
+#define UP_CE_PIN 5                 // CE Pin of the NRF facing the Master
+#define UP_CS_PIN 17                // CS Pin of the NRF facing the Master
+#define UP_IRQ_PIN 4                // IRQ Pin of the NRF facing the Master, needed for the Slave side
+#define DOWN_CE_PIN 16              // CE Pin of the NRF facing the downstream Slave
+#define DOWN_CS_PIN 15              // CS Pin of the NRF facing the downstream Slave
+#define POWER_LEVEL 0               // 0 lowest Power, 3 highest Power (Use separate 3.3v power supply for NRF above 0)
+#define PACKET_SIZE 32              // Max 32 Bytes. Must match both links
+#define NUMBER_OF_DOWN_PACKETS 2    // Packets per frame from the Master, passed down to the downstream Slave
+#define NUMBER_OF_UP_PACKETS 2      // Packets per frame from the downstream Slave, passed up to the Master
+#define FRAME_RATE 50               // Must match the Master and downstream Slave. The downstream exchange runs before our reply upstream so keep it to about half the usual maximum
+
+StaticRadioSlave<PACKET_SIZE, NUMBER_OF_UP_PACKETS, NUMBER_OF_DOWN_PACKETS> upstream;
+StaticRadioMaster<PACKET_SIZE, NUMBER_OF_DOWN_PACKETS, NUMBER_OF_UP_PACKETS> downstream;
+RadioRelay relay;
+
+void setup() {
+    Serial.begin(115200);
+
+    upstream.SetAddresses("UST01", "ALT01");
+    upstream.GenerateChannels(76, 124, 12345);
+    upstream.Init(&SPI, UP_CE_PIN, UP_CS_PIN, UP_IRQ_PIN, POWER_LEVEL, FRAME_RATE);
+
+    downstream.SetAddresses("UST02", "ALT02");
+    downstream.GenerateChannels(76, 124, 54321);
+    downstream.Init(&SPI, DOWN_CE_PIN, DOWN_CS_PIN, POWER_LEVEL, FRAME_RATE);
+
+    // Forward PACKET1 both ways. The masks are a bit per packet id
+    relay.Begin(&upstream, &downstream, 1 << PACKET1, 1 << PACKET1);
+
+    TaskHandle_t statusTask;
+    xTaskCreatePinnedToCore(relayStatusTask, "RelayStatus", 4096, NULL, 1, &statusTask, 1);
+    relay.SetNotifyTask(statusTask);
+    relay.StartTask(1);
+}
+
+void relayStatusTask(void *pvParameters) {
+    Serial.println("Relay Status Task On: " + String(xPortGetCoreID()) + " | " + String(ESP.getCpuFreqMHz()) + "MHz");
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // Wait for the relay task to finish a frame
+
+        if (relay.IsSecondTick()) {
+            String dataString = "---- Relay ----\n";
+            dataString += "Upstream/Downstream Rec. Per Second: " + String(upstream.GetRecievedPacketsPerSecond()) + " | " + String(downstream.GetRecievedPacketsPerSecond()) + "\n";
+            dataString += "Forwarded Down/Up Per Second: " + String(relay.GetForwardedPerSecond(RELAY_DOWNSTREAM)) + " | " + String(relay.GetForwardedPerSecond(RELAY_UPSTREAM)) + "\n";
+            dataString += "Down Forward p50/p99/max us: " + String(relay.GetForwardLatencyPercentileMicros(RELAY_DOWNSTREAM, 50)) + " | " + String(relay.GetForwardLatencyPercentileMicros(RELAY_DOWNSTREAM, 99)) + " | " + String(relay.GetMaxForwardLatencyMicros(RELAY_DOWNSTREAM)) + "\n";
+            dataString += "Up Forward p50/p99/max us: " + String(relay.GetForwardLatencyPercentileMicros(RELAY_UPSTREAM, 50)) + " | " + String(relay.GetForwardLatencyPercentileMicros(RELAY_UPSTREAM, 99)) + " | " + String(relay.GetMaxForwardLatencyMicros(RELAY_UPSTREAM)) + "\n";
+            dataString += "---------------\n";
+            Serial.print(dataString);
+        }
+    }
+}
+
+void loop() {vTaskDelete(NULL);}
@@ -1,58 +1,109 @@
 #include "RadioSlave.h"
+#if defined(ESP32)
+  #include "esp_sleep.h"
+#else
+  #error "RadioSlave needs the ESP32 Arduino core for attachInterruptArg and its radio task pinned to a core"
+#endif
 
-RadioSlave* RadioSlave::handlerInstance = nullptr;
-
-void RadioSlave::Init(_SPI* spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ, int8_t powerLevel, uint8_t packetSize, uint8_t numberOfSendPackets, uint8_t numberOfReceivePackets, uint8_t frameRate)
+void RadioSlave::Init(_SPI* spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ, int8_t powerLevel, uint8_t packetSize, uint8_t numberOfSendPackets, uint8_t numberOfReceivePackets, uint16_t frameRate)
 {
-  handlerInstance = this;
   this->numberOfSendPackets = (numberOfSendPackets < 0) ? 0 : ((numberOfSendPackets > 3) ? 3 : numberOfSendPackets);
   this->numberOfReceivePackets = (numberOfReceivePackets < 0) ? 0 : ((numberOfReceivePackets > 3) ? 3 : numberOfReceivePackets);
   this->packetSize = (packetSize < 1) ? 1 : ((packetSize > 32) ? 32 : packetSize);
-  powerLevel = (powerLevel < 0) ? 0 : ((powerLevel > 3) ? 3: powerLevel);
+  this->powerLevel = (powerLevel < 0) ? 0 : ((powerLevel > 3) ? 3: powerLevel);
+  maxPowerLevel = this->powerLevel;
+  linkQuality.Reset();
+  powerController.Reset(maxPowerLevel, powerTargetPercent);
 
-  for (int i = 0; i < numberOfSendPackets; ++i) 
+  //Buffers already attached (StaticRadio variants or a previous Init) are reused so Init never leaks
+  for (int i = 0; i < this->numberOfSendPackets; ++i) 
   {
-    sendPackets[i] = new uint8_t[packetSize]();
+    if(sendPackets[i] == nullptr) { sendPackets[i] = new uint8_t[MAXPACKETSIZE](); }
   }
 
-  for (int i = 0; i < numberOfReceivePackets; ++i) 
+  for (int i = 0; i < this->numberOfReceivePackets; ++i) 
   {
-    recievePackets[i] = new uint8_t[packetSize]();
+    if(recievePackets[i] == nullptr) { recievePackets[i] = new uint8_t[MAXPACKETSIZE](); }
   }
 
+  UpdateHeaderSizes();
   ClearSendPackets();
   ClearReceivePackets();
 
   //Radio
-  spiPort->begin();
-  radio.begin(spiPort, pinCE, pinCS);
-  radio.stopListening();
-  radio.powerDown();
-  radio.setPALevel(powerLevel);
-  // radio.setAddressWidth(3);
-  radio.openReadingPipe(1, address[0]);  // Master address
-  radio.openWritingPipe(address[1]);     // Slave address
-  radio.setDataRate(RF24_1MBPS);
-  radio.setAutoAck(false);
-  radio.setRetries(0, 0);
-  radio.setPayloadSize(this->packetSize);
-  radio.setChannel(channels_Gen[currentChannelIndex]);
-  radio.maskIRQ(true, true, false);
-  radio.powerUp();
-  radio.startListening();
+  ConfigureRadio(radio, spiPort, pinCE, pinCS);
 
-  //Interrupt for Radio
-  attachInterrupt(digitalPinToInterrupt(pinIRQ), StaticIRQHandler, FALLING);
+  //Interrupt for Radio. The instance is passed through so several radios can each have their own IRQ pin
+  attachInterruptArg(digitalPinToInterrupt(pinIRQ), StaticIRQHandler, this, FALLING);
 
   //Frame Timing
-  this->frameRate = (frameRate < 10) ? 10 : ((frameRate > 120) ? 120 : frameRate);  //Clamp between 10 and 120
-  microsPerFrame = 1000000 / frameRate;
+  //Clamp between 10 and 500, or lower if the data rate and packets don't fit in a frame. Matches the Master's clamp
+  this->frameRate = ClampFrameRate(frameRate, MinFrameMicros(this->packetSize, this->numberOfReceivePackets, this->numberOfSendPackets, dataRate));
+  microsPerFrame = 1000000 / this->frameRate;
+  totalAdjustedDrift = 0;
+
+  //Warm start from the frame time tracked against this Master last time, if it is close enough to the nominal one to be the same frame rate
+  int32_t warmDrift = (int32_t)(warmMicrosPerFrame - microsPerFrame);
+  if(warmMicrosPerFrame > 0 && abs(warmDrift) <= (int32_t)(microsPerFrame / 1000))
+  {
+    microsPerFrame = warmMicrosPerFrame;
+    totalAdjustedDrift = warmDrift;
+  }
   halfMicrosPerFrame = microsPerFrame / 2;
   minOverflowProtection = microsPerFrame * 3;
   maxOverflowProtection = 0xffffffff - (microsPerFrame * 3);
-  syncDelay = microsPerFrame / 8;
+  syncDelay = ReplyDelayMicros(this->packetSize, this->numberOfReceivePackets, dataRate);
+  burstSlotMicros = BurstPacketSlotMicros(this->packetSize, dataRate);
+  txPipelineMicros = RADIO_SPI_LOAD_MICROS + RADIO_TX_SETTLE_MICROS + PacketAirtimeMicros(this->packetSize, dataRate);
+  failedBeforeScanning = (this->frameRate > 200) ? this->frameRate / 4 : 50;
+  secondStartTime = micros();
+  ResetLatencyStats();
+  ResetSequenceStats();
+}
+
+
+void RadioSlave::InitDiversity(_SPI* spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ)
+{
+  ConfigureRadio(diversityRadio, spiPort, pinCE, pinCS);
+  linkHistory[1] = 0;
+  isDiversityEnabled = true;
+
+  //Each radio time stamps the burst on its own IRQ, Receive averages whichever of them heard it
+  attachInterruptArg(digitalPinToInterrupt(pinIRQ), StaticDiversityIRQHandler, this, FALLING);
+}
+
+void RadioSlave::ConfigureRadio(RF24& target, _SPI* spiPort, uint8_t pinCE, uint8_t pinCS)
+{
+  spiPort->begin();
+  target.begin(spiPort, pinCE, pinCS);
+  target.stopListening();
+  target.powerDown();
+  target.setPALevel(powerLevel);
+  // target.setAddressWidth(3);
+  target.openReadingPipe(1, address[0]);  // Master address
+  target.openWritingPipe(address[1]);     // Slave address
+  target.setDataRate(dataRate);
+  TrimRadioDelays(target);
+  target.setAutoAck(false);
+  target.setRetries(0, 0);
+  target.setPayloadSize(packetSize);
+  target.setChannel(channels_Gen[currentChannelIndex]);
+  target.maskIRQ(true, true, false);
+  target.powerUp();
+  target.startListening();
+}
+
+void RadioSlave::StartListening()
+{
+  radio.startListening();
+  if(isDiversityEnabled) { diversityRadio.startListening(); }
 }
 
+void RadioSlave::StopListening()
+{
+  radio.stopListening();
+  if(isDiversityEnabled) { diversityRadio.stopListening(); }
+}
 
 void RadioSlave::SetAddresses(const char* masterID, const char* slaveID)
 {
@@ -60,45 +111,179 @@ void RadioSlave::SetAddresses(const char* masterID, const char* slaveID)
     strncpy((char*)address[1], slaveID, 5);   // Slave address
 }
 
-void RadioSlave::GenerateChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t seed)
+bool RadioSlave::Bind(LinkParameters& link, uint32_t timeoutMillis)
+{
+  radio.stopListening();
+  radio.setChannel(BIND_CHANNEL);
+  radio.setPayloadSize(BIND_PAYLOAD_SIZE);
+  radio.openWritingPipe((const uint8_t*)BIND_ADDRESS);
+  radio.openReadingPipe(1, (const uint8_t*)BIND_ADDRESS);
+  radio.startListening();
+
+  //Accept the first valid offer, then keep answering repeats of it for a while in case our reply was lost
+  bool isBound = false;
+  uint32_t startTime = millis();
+  uint32_t boundTime = 0;
+  while(isBound ? (millis() - boundTime < BIND_LINGER_MILLIS) : (millis() - startTime < timeoutMillis))
+  {
+    if(!radio.available())
+    {
+      vTaskDelay(1);
+      continue;
+    }
+
+    uint8_t offer[BIND_PAYLOAD_SIZE];
+    radio.read(offer, BIND_PAYLOAD_SIZE);
+    LinkParameters offered;
+    memcpy(&offered, &offer[1], sizeof(offered));
+    if(offer[0] != BIND_OFFER || !IsLinkValid(offered)) { continue; }
+    if(isBound && offered.checksum != link.checksum) { continue; }  //A second Master binding nearby
+
+    if(!isBound)
+    {
+      link = offered;
+      isBound = true;
+      boundTime = millis();
+    }
+
+    uint8_t reply[BIND_PAYLOAD_SIZE] = {BIND_ACCEPT};
+    memcpy(&reply[1], &link.checksum, sizeof(link.checksum));
+    radio.stopListening();
+    radio.write(reply, BIND_PAYLOAD_SIZE);
+    radio.startListening();
+  }
+
+  //Back to how Init left the radio
+  radio.stopListening();
+  radio.setPayloadSize(packetSize);
+  radio.openReadingPipe(1, address[0]);
+  radio.openWritingPipe(address[1]);
+  radio.setChannel(channels_Gen[currentChannelIndex]);
+  radio.startListening();
+  isIrqPending[0] = false;
+  return isBound;
+}
+
+void RadioSlave::UseLink(const LinkParameters& link)
 {
-    randomSeed(seed);
-    uint8_t availableNumbers[upperBound - lowerBound + 1];
-    for (uint8_t i = 0; i <= (upperBound - lowerBound); i++) availableNumbers[i] = lowerBound + i;
+    memcpy(address[0], link.masterAddress, 5);  //Random bytes, may hold a 0 so not through SetAddresses
+    memcpy(address[1], link.slaveAddress, 5);
+    SetHopping(link.channelsToHop, link.framesPerHop);
+    if(link.flags & LINK_ORTHOGONAL) { GenerateOrthogonalChannels(link.lowerBound, link.upperBound); }
+    else { GenerateChannels(link.lowerBound, link.upperBound, link.hopSeed); }
+    warmMicrosPerFrame = link.microsPerFrame;
+}
 
-    for (int i = (upperBound - lowerBound); i > 0; i--)
+bool RadioSlave::StoreFrameTime(LinkStorage& storage, LinkParameters& link)
+{
+    //Only a locked frame time is worth keeping. The tracker walks it by 1 us every frame, so once one is stored
+    //only rewrite flash when it has really moved, and not more often than LINK_SAVE_MIN_MILLIS
+    if(radioState != STATE_FULL_LOCK) { return false; }
+    uint32_t trackedMicrosPerFrame = microsPerFrame;
+    if(link.microsPerFrame != 0)
     {
-        int j = random(0, i + 1);
-        uint8_t temp = availableNumbers[i];
-        availableNumbers[i] = availableNumbers[j];
-        availableNumbers[j] = temp;
+      uint32_t threshold = link.microsPerFrame / LINK_SAVE_FRAME_DIVISOR;
+      if(threshold < 2) { threshold = 2; }
+      if((uint32_t)abs((int32_t)(trackedMicrosPerFrame - link.microsPerFrame)) < threshold) { return false; }
+      if(millis() - lastFrameTimeSave < LINK_SAVE_MIN_MILLIS) { return false; }
     }
 
-    channels_Gen[0] = 125;  // Reserve first channel
-    for (int i = 1; i < 40; i++) channels_Gen[i] = availableNumbers[i - 1];
+    link.microsPerFrame = trackedMicrosPerFrame;
+    SealLink(link);
+    lastFrameTimeSave = millis();
+    return storage.Save(link);
 }
 
-void RadioSlave::StaticIRQHandler()
+void RadioSlave::GenerateChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t seed)
 {
-  if (handlerInstance != nullptr) 
-  {
-    handlerInstance->IRQHandler();
-  }
+    SetChannels(MakeHopTable(lowerBound, upperBound, seed));
 }
-  
-volatile uint32_t lastInterruptTimeStamp = 0;
 
-void RadioSlave::IRQHandler()
+void RadioSlave::SetHopping(uint8_t channelsToHop, uint8_t framesPerHop)
+{
+    this->channelsToHop = (channelsToHop < 1) ? 1 : ((channelsToHop > HOP_TABLE_SIZE) ? HOP_TABLE_SIZE : channelsToHop);
+    this->framesPerHop = (framesPerHop < 1) ? 1 : ((framesPerHop > HOP_MAX_FRAMES_PER_HOP) ? HOP_MAX_FRAMES_PER_HOP : framesPerHop);
+    hopOnLockValue = this->framesPerHop - 1;
+    currentChannelIndex = 0;
+    channelHopCounter = 0;
+    StartScan();
+}
+
+void RadioSlave::SetChannels(const HopTable& table)
+{
+    memcpy(channels_Gen, table.channels, sizeof(channels_Gen));
+}
+
+void RadioSlave::GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound)
+{
+    GenerateOrthogonalChannels(lowerBound, upperBound, HopAddressHash(address[0], address[1]));
+}
+
+void RadioSlave::GenerateOrthogonalChannels(uint8_t lowerBound, uint8_t upperBound, uint32_t pairNumber)
+{
+    SetChannels(MakeOrthogonalHopTable(lowerBound, upperBound, pairNumber));
+    channelsToHop = OrthogonalHopLength(lowerBound, upperBound);
+    currentChannelIndex = 0;
+    channelHopCounter = 0;
+}
+
+void RadioSlave::GenerateChannelsFromList(const uint8_t* channels, uint8_t count, uint32_t seed)
+{
+    SetChannels(MakeHopTableFromList(channels, count, seed));
+}
+
+void RadioSlave::SurveySpectrum(SpectrumSurvey& survey, uint16_t sweeps, uint16_t dwellMicros)
+{
+    survey.Run(radio, sweeps, dwellMicros);
+
+    //Back on the hop channel and listening, as Init left it. A packet heard mid survey is no use for timing,
+    //it is still read out as normal so the IRQ can fire again
+    radio.setChannel(channels_Gen[currentChannelIndex]);
+    radio.startListening();
+    isIrqPending[0] = false;
+}
+
+void IRAM_ATTR RadioSlave::StaticIRQHandler(void* instance)
+{
+  static_cast<RadioSlave*>(instance)->IRQHandler(0);
+}
+
+void IRAM_ATTR RadioSlave::StaticDiversityIRQHandler(void* instance)
+{
+  static_cast<RadioSlave*>(instance)->IRQHandler(1);
+}
+
+void IRAM_ATTR RadioSlave::IRQHandler(uint8_t radioIndex)
 { 
-    interruptTimeStamp = micros() + syncDelay;
+    uint32_t timeStamp = micros();
 
-    if(interruptTimeStamp - lastInterruptTimeStamp < halfMicrosPerFrame) //In case our interrupt acted wierd on multiple packets
+    if(timeStamp - lastIrqTimeStamps[radioIndex] < halfMicrosPerFrame) //In case our interrupt acted wierd on multiple packets
     {
+      RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_IRQ, 0, 0);
       return;
     }
+    RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_IRQ, 1, 0);
     
-    isSyncFrame = true;
-    lastInterruptTimeStamp = interruptTimeStamp;
+    //Which packet raised it is only known once Receive reads the FIFO, the time stamp is corrected there
+    irqTimeStamps[radioIndex] = timeStamp;
+    isIrqPending[radioIndex] = true;
+    syncChannelIndex = currentChannelIndex;
+    lastIrqTimeStamps[radioIndex] = timeStamp;
+}
+
+void RadioSlave::AddSyncSample(uint32_t burstStart)
+{
+  if(syncSampleCount == 0)
+  {
+    syncSampleBase = burstStart;
+    syncSampleSum = 0;
+    syncIrqTimeStamp = burstStart;
+  }
+  else
+  {
+    syncSampleSum += (int32_t)(burstStart - syncSampleBase);
+  }
+  syncSampleCount++;
 }
 
 
@@ -107,7 +292,8 @@ void RadioSlave::ClearSendPackets()
   for(int i = 0; i < numberOfSendPackets; i++)
   {
     memset(sendPackets[i], 0, packetSize);
-    byteAddCounter[i] = 1;
+    byteAddCounter[i] = sendHeaderSize[i];
+    isSendStamped[i] = false;
   }
 }
 
@@ -117,7 +303,7 @@ void RadioSlave::ClearReceivePackets()
   {
     receivePacketsAvailable[i] = false;
     memset(recievePackets[i], 0, packetSize);
-    byteReceiveCounter[i] = 1;
+    byteReceiveCounter[i] = receiveHeaderSize[i];
   }
 }
 
@@ -129,6 +315,7 @@ void RadioSlave::SetNextFrameEnd(uint32_t newTime)
 
 void RadioSlave::AdvanceFrame()
 {
+    currentFrameStart = frameTimeEnd;
     uint32_t localInterruptTimeStamp = interruptTimeStamp;
     bool localIsSyncFrame = isSyncFrame;
     isSyncFrame = false;
@@ -146,14 +333,14 @@ void RadioSlave::AdvanceFrame()
         return; 
       }
 
-      uint32_t futureLocalInterruptTimeStamp = localInterruptTimeStamp + microsPerFrame;
-      int32_t diffA = localInterruptTimeStamp - frameTimeEnd;
-      int32_t diffB = futureLocalInterruptTimeStamp - frameTimeEnd;
-      int32_t drift;
-
-      drift = (abs(diffA) < abs(diffB)) ? diffA : diffB;
+      //The sample is from the start of the frame that is just ending, or older while scanning.
+      //Only its phase matters, so take the nearest frame boundary to it
+      int32_t drift = (int32_t)(localInterruptTimeStamp - frameTimeEnd) % (int32_t)microsPerFrame;
+      if(drift > (int32_t)halfMicrosPerFrame) { drift -= microsPerFrame; }
+      else if(drift < -(int32_t)halfMicrosPerFrame) { drift += microsPerFrame; }
 
       SetNextFrameEnd(frameTimeEnd + microsPerFrame + drift);
+      RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_DRIFT, 0, (int16_t)constrain(drift, -32768, 32767));
       if(drift < 0)
       {
         totalAdjustedDrift--;
@@ -197,9 +384,12 @@ void RadioSlave::UpdateScanning(bool isSuccess)
     {
       if(radioState == STATE_SCANNING)
       {
-        AdjustChannelIndex(2);
-        radio.startListening();
-        radioState = STATE_PARTIAL_LOCK;
+        //Pick up the Master's schedule. Its packet came in on syncChannelIndex, and if that was the last frame
+        //on the channel it has since hopped forward, which a locked Slave would already have done too
+        int8_t lockedIndex = syncChannelIndex + ((channelHopCounter == hopOnLockValue) ? 1 : 0);
+        AdjustChannelIndex(lockedIndex - currentChannelIndex);
+        StartListening();
+        SetRadioState(STATE_PARTIAL_LOCK);
         partialLockCounter = 0;
       }
       else if(radioState == STATE_PARTIAL_LOCK)
@@ -208,14 +398,18 @@ void RadioSlave::UpdateScanning(bool isSuccess)
 
         if(isSuccess)
         {
-          radioState = STATE_FULL_LOCK;
+          SetRadioState(STATE_FULL_LOCK);
         }
 
         if(partialLockCounter > 10)
         {
-          radioState = STATE_SCANNING;
+          SetRadioState(STATE_SCANNING);
         }
       }
+      else if(radioState == STATE_COASTING)
+      {
+        SetRadioState(STATE_FULL_LOCK);  //Still on the Master's channel and frame, nothing to reacquire
+      }
     }
     else
     { 
@@ -225,12 +419,60 @@ void RadioSlave::UpdateScanning(bool isSuccess)
     if(failedCounter >= failedBeforeScanning)
     {
       failedCounter = 0;
-      radioState = STATE_SCANNING;
+      if(radioState == STATE_FULL_LOCK && coastMicros > 0)
+      {
+        coastStartTime = micros();
+        SetRadioState(STATE_COASTING);
+      }
+      else if(radioState != STATE_COASTING)
+      {
+        SetRadioState(STATE_SCANNING);
+      }
     }  
+
+    if(radioState == STATE_COASTING && micros() - coastStartTime >= coastMicros)
+    {
+      SetRadioState(STATE_SCANNING);
+    }
   }
 
+void RadioSlave::SetRadioState(uint8_t newState)
+{
+  if(newState == radioState) { return; }
+  RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_STATE, radioState, newState);
+
+  if(newState == STATE_SCANNING) { StartScan(); }
+  if(radioState == STATE_FULL_LOCK)
+  {
+    //The link actually went quiet failedBeforeScanning frames ago
+    outageStartTime = micros() - failedBeforeScanning * microsPerFrame;
+    isOutage = true;
+  }
+  else if(newState == STATE_FULL_LOCK && isOutage)
+  {
+    lastRecoveryMicros = micros() - outageStartTime;
+    recoveryTotalMicros += lastRecoveryMicros;
+    recoveryCount++;
+    isOutage = false;
+  }
+  radioState = newState;
+}
+
+void RadioSlave::StartScan()
+{
+  scanPredictedIndex = currentChannelIndex;
+  scanOffset = 0;
+  scanFrame = 0;
+}
+
 void RadioSlave::UpdateSecondCounter()
 {
+  frameCount++;
+  if(isPowerControlEnabled)
+  {
+    linkQuality.EndFrame(numberOfReceivePackets);
+    ApplyPowerLevel(powerController.EndFrame());
+  }
   secondCounter++;
   isSecondTick = false;
   if(secondCounter >= frameRate)
@@ -240,6 +482,18 @@ void RadioSlave::UpdateSecondCounter()
     recievedPacketCount = 0;
     sentPerSecond = sentPacketCount;
     sentPacketCount = 0;
+    uint32_t now = micros();
+    uint32_t secondMicros = now - secondStartTime;
+    radioDutyPermille = (secondMicros > radioSleepMicros) ? 1000 - (uint64_t)radioSleepMicros * 1000 / secondMicros : 0;
+    radioSleepMicros = 0;
+    secondStartTime = now;
+    for(int i = 0; i < DIVERSITY_RADIOS; i++)
+    {
+      diversityReceivedPerSecond[i] = diversityReceivedCount[i];
+      diversityReceivedCount[i] = 0;
+    }
+    txStartLatencyPerSecond = txStartLatencyMax;
+    txStartLatencyMax = 0;
     isSecondTick = true;
   }
 }
@@ -247,22 +501,16 @@ void RadioSlave::UpdateSecondCounter()
   void RadioSlave::AdjustChannelIndex(int8_t amount)
   {      
 
-    currentChannelIndex += amount;
-
-    if(currentChannelIndex >= channelsToHop) {currentChannelIndex = channelsToHop - currentChannelIndex; }
-    if(currentChannelIndex < 0) {currentChannelIndex += channelsToHop;}
+    int16_t newIndex = currentChannelIndex + amount;
 
-    hopOnScanCounter++;
-    if(hopOnScanCounter >= channelsToHop)
-    {
-      hopOnScanCounter = 0;
-      hopOnScanValue++;
-      if(hopOnScanValue >= framesPerHop) {hopOnScanValue = 0;}
-    }
+    if(newIndex >= channelsToHop) {newIndex -= channelsToHop; }
+    if(newIndex < 0) {newIndex += channelsToHop;}
+    currentChannelIndex = newIndex;
 
-    radio.stopListening();
+    StopListening();
     radio.setChannel(channels_Gen[currentChannelIndex]);
-      
+    if(isDiversityEnabled) { diversityRadio.setChannel(channels_Gen[currentChannelIndex]); }
+    RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_HOP, currentChannelIndex, channels_Gen[currentChannelIndex]);
   }
 
 
@@ -274,13 +522,26 @@ void RadioSlave::UpdateSecondCounter()
 
     if(radioState == STATE_SCANNING)
     {
-      if(channelHopCounter == hopOnScanValue)
+      //Keep stepping the schedule we last had, the Master is still on it after being shadowed. One frame in
+      //SCAN_PREDICTED_EVERY listens there, the others sweep one offset from it each. The Master holds its
+      //offset from that schedule however fast it hops, so a restarted or never heard Master is found within
+      //channelsToHop sweep frames
+      if(channelHopCounter == hopOnLockValue) { scanPredictedIndex = (scanPredictedIndex + 1) % channelsToHop; }
+      scanFrame++;
+      if(scanFrame >= SCAN_PREDICTED_EVERY) { scanFrame = 0; }
+      int16_t targetIndex = scanPredictedIndex;
+      if(scanFrame != 0)
+      {
+        scanOffset = (scanOffset <= 1) ? channelsToHop - 1 : scanOffset - 1;
+        targetIndex = (scanPredictedIndex + scanOffset) % channelsToHop;
+      }
+      if(targetIndex != currentChannelIndex)
       {
-        AdjustChannelIndex(-1);
+        AdjustChannelIndex(targetIndex - currentChannelIndex);
         needsToHop = true;
       }
     }
-    else if(radioState == STATE_FULL_LOCK)
+    else  //Partial lock, full lock and coasting all follow the Master's schedule
     {
       if(channelHopCounter == hopOnLockValue)
       {
@@ -293,59 +554,432 @@ void RadioSlave::UpdateSecondCounter()
 
 
 
+void RadioSlave::UpdateTxStartLatency(uint32_t latency)
+{
+  txStartLatency = latency;
+  if(latency > txStartLatencyMax) { txStartLatencyMax = latency; }
+}
+
 void RadioSlave::WaitAndSend()
 {
-  while(!IsFrameReady()) {vTaskDelay(1);}
+  RADIO_PROFILE_START(waitStart);
+  while(!IsFrameReady())
+  {
+    if(isRadioAsleep)
+    {
+      WaitForListenWindow();
+      continue;
+    }
+    //Spin the last tick, the Master is only listening for our reply for a short window after its burst
+    if((int32_t)(frameTimeEnd - micros()) > RADIO_TICK_MICROS) { vTaskDelay(1); }
+  }
+  if(isRadioAsleep) { WakeRadio(); }  //Frame was already due, or the window wait overran. Still send and read the burst
+  RADIO_PROFILE_END(PROFILE_WAIT, waitStart);
+  uint32_t frameStartTimeStamp = micros();
+  RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_FRAME_START, channelHopCounter, currentChannelIndex);
 
+  //The Master's burst for this frame is already in the FIFO. Read it before filling our reply, so the fill
+  //callback can answer it in this frame's reply instead of the next one
+  ReadBurst();
+  DispatchReceived();
 
+  RADIO_PROFILE_START(fillStart);
+  if(fillFrameCallback != nullptr) { fillFrameCallback(fillFrameCallbackContext); }
+  RADIO_PROFILE_END(PROFILE_FILL, fillStart);
+
+  RADIO_PROFILE_START(hopStart);
   bool hasStoppedListening = UpdateHop();
+  RADIO_PROFILE_END(PROFILE_HOP, hopStart);
+
   if(radioState == STATE_FULL_LOCK)
   {
+    RADIO_PROFILE_START(sendStart);
+    UpdateTxRadio();
+    RF24& txRadio = GetRadio(txRadioIndex);
     if(!hasStoppedListening)
     {
-      radio.stopListening();
+      txRadio.stopListening();
       hasStoppedListening = true;
     }
+    //Queue the whole burst into the TX FIFO and wait once for it to drain
     for(int i = 0; i < numberOfSendPackets; i++)
     {
       sendPackets[i][0] = i;
-      radio.write(sendPackets[i], packetSize);
+      if(isLatencyEnabled) { WriteLatencyHeader(sendPackets[i], i); }
+      if(isSequenceEnabled) { sendPackets[i][sequenceOffset] = frameCount; }
+      if(isTimeSyncEnabled && i == PACKET1) { WriteTimeSyncHeader(sendPackets[i]); }
+      if(isPowerControlEnabled && i == PACKET1) { linkQuality.WriteReport(&sendPackets[i][sendHeaderSize[i] - POWER_REPORT_BYTES]); }
+      txRadio.writeFast(sendPackets[i], packetSize);
+      if(i == 0) { UpdateTxStartLatency(micros() - frameStartTimeStamp + RADIO_TX_SETTLE_MICROS); }  //CE is high, the first bit follows the PLL settling
     }
+    if(numberOfSendPackets > 0) { txRadio.txStandBy(); }
+    RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_TX_DONE, numberOfSendPackets, txStartLatency);
+    sentPacketCount += numberOfSendPackets;
+    RADIO_PROFILE_END(PROFILE_SEND, sendStart);
   }
 
   if(hasStoppedListening)
   {
-    radio.startListening();
+    StartListening();
   }
 
+  RADIO_PROFILE_START(clearStart);
   ClearSendPackets();
+  RADIO_PROFILE_END(PROFILE_CLEAR, clearStart);
 }
 
-void RadioSlave::Receive()
+void RadioSlave::ReadBurst()
 {
   bool isSuccess = false;
+  RADIO_PROFILE_START(clearStart);
   ClearReceivePackets();
-    
-  for(int i = 0; i < 3; i++)   //Always check 3 times to clear the input buffers otherwise interrupt wont trigger
+  RADIO_PROFILE_END(PROFILE_CLEAR, clearStart);
+
+  RADIO_PROFILE_START(receiveStart);
+  for(int r = 0; r < (isDiversityEnabled ? DIVERSITY_RADIOS : 1); r++)
   {
-    if (radio.available())
+    bool isRadioSuccess = ReadRadio(r);
+    linkHistory[r] = (linkHistory[r] << 1) | (isRadioSuccess ? 1 : 0);
+    isSuccess |= isRadioSuccess;
+  }
+  if(syncSampleCount > 0)
+  {
+    //One phase estimate per frame from every radio that heard the burst, applied at the next frame boundary
+    interruptTimeStamp = syncSampleBase + syncSampleSum / syncSampleCount + syncDelay;
+    isSyncFrame = true;
+    syncSampleCount = 0;
+  }
+  if(isSuccess) { failedCounter = 0; }
+  isBurstReceived = isSuccess;
+  RADIO_PROFILE_END(PROFILE_RECEIVE, receiveStart);
+}
+
+void RadioSlave::Receive()
+{
+  //The burst was read at the start of WaitAndSend, what is left is the lock tracking once our reply is out
+  UpdateScanning(isBurstReceived);
+  UpdateSecondCounter();
+  if(isLowPowerEnabled && radioState == STATE_FULL_LOCK) { SleepRadio(); }
+  if(notifyTask != nullptr) { xTaskNotifyGive(notifyTask); }
+}
+
+void RadioSlave::SleepRadio()
+{
+  //Our reply has gone and the burst is read, nothing is due until the Master's next burst. Standby keeps the
+  //channel and wakes in the RX settle time, where power down would need milliseconds to start up again
+  StopListening();
+  isRadioAsleep = true;
+  radioSleepStart = micros();
+}
+
+void RadioSlave::WaitForListenWindow()
+{
+  //The Master's first packet starts its airtime before the IRQ, and RX needs its settle time before that
+  uint32_t listenLead = syncDelay + PacketAirtimeMicros(packetSize, dataRate) + RADIO_TX_SETTLE_MICROS + lowPowerGuardMicros;
+  int32_t untilListen = (int32_t)(frameTimeEnd - listenLead - micros());
+  if(isLowPowerEnabled && untilListen > 0)
+  {
+#if defined(ESP32)
+    if(isLightSleepEnabled && untilListen > LOWPOWER_LIGHT_SLEEP_MIN_MICROS)
+    {
+      esp_sleep_enable_timer_wakeup(untilListen - LOWPOWER_WAKE_MICROS);
+      esp_light_sleep_start();
+      return;
+    }
+#endif
+    if(untilListen > RADIO_TICK_MICROS) { vTaskDelay(1); }
+    return;
+  }
+  WakeRadio();
+}
+
+void RadioSlave::WakeRadio()
+{
+  radioSleepMicros += micros() - radioSleepStart;
+  isRadioAsleep = false;
+  StartListening();
+}
+
+void RadioSlave::EnableLowPower(uint16_t guardMicros, bool useLightSleep)
+{
+  lowPowerGuardMicros = guardMicros;
+  isLightSleepEnabled = useLightSleep;
+  isLowPowerEnabled = true;
+}
+
+bool RadioSlave::ReadRadio(uint8_t radioIndex)
+{
+  RF24& source = GetRadio(radioIndex);
+  bool isRadioSuccess = false;
+  bool hasIrq = isIrqPending[radioIndex];
+  isIrqPending[radioIndex] = false;
+  uint8_t pipe;
+  //Read until the status says the FIFO is empty, it has to be emptied for the interrupt to fire again.
+  //One status read per packet gives the pipe too, and there is no polling past the last one
+  for(int i = 0; i < RADIO_RX_FIFO_DEPTH; i++)
+  {
+    if (source.available(&pipe))
     {  
-      isSuccess = true;
-      recievedPacketCount++;
-      failedCounter = 0;
       uint8_t currentPacket[packetSize];
-      radio.read(currentPacket, packetSize);
+      source.read(currentPacket, packetSize);
       uint8_t firstByte = currentPacket[0];
       uint8_t packetId = firstByte & 0x03;
+      if(packetId >= numberOfReceivePackets) { continue; }  //Mismatched packet count on the Master
+      isRadioSuccess = true;
+      diversityReceivedCount[radioIndex]++;
+
+      //The IRQ was raised by the first packet in the FIFO. Move its time stamp back by that packet's slot in the
+      //burst, so frames where PACKET1 was lost still give the same sync point
+      if(i == 0 && hasIrq) { AddSyncSample(irqTimeStamps[radioIndex] - packetId * burstSlotMicros); }
+
+      //The other radio already delivered this packet id this frame. Keep the later copy but only count it once
+      bool isDuplicate = receivePacketsAvailable[packetId];
+      if(!isDuplicate && isSequenceEnabled && !sequenceTrackers[packetId].Accept(currentPacket[sequenceOffset], frameCount)) { continue; }  //Late or repeated, keep what we have
       memcpy(recievePackets[packetId], currentPacket, packetSize);
       receivePacketsAvailable[packetId] = true;
+      receivePipes[packetId] = pipe;
+      if(isDuplicate) { continue; }
+
+      recievedPacketCount++;
+      RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_RX, packetId, 1);
+      if(isLatencyEnabled) { RecordLatency(packetId, currentPacket, currentFrameStart - syncDelay - txPipelineMicros); }  //Our frames start syncDelay after the IRQ for the Master's first packet, which started its burst txPipelineMicros before that
+      if(isTimeSyncEnabled && packetId == PACKET1) { ReadMasterTimeSync(currentPacket); }
+      if(isPowerControlEnabled)
+      {
+        linkQuality.AddPacket(source.testRPD());
+        if(packetId == PACKET1) { ApplyPowerLevel(powerController.OnReport(&currentPacket[receiveHeaderSize[PACKET1] - POWER_REPORT_BYTES])); }
+      }
+      //UpdateHop steps the counter on to this frame's value straight after, so keep it one behind the Master's
       uint8_t txChannelHopCounter = (firstByte & 0xE0) >> 5;
-      channelHopCounter = txChannelHopCounter; 
+      channelHopCounter = ((txChannelHopCounter == 0) ? framesPerHop : txChannelHopCounter) - 1;
+    }
+    else
+    {
+      break;
     }
   }
+  return isRadioSuccess;
+}
 
-  UpdateScanning(isSuccess);
-  UpdateSecondCounter();
+void RadioSlave::UpdateTxRadio()
+{
+  if(!isDiversityEnabled) { return; }
+
+  //Transmit from whichever radio has heard the Master most often over the last 32 frames
+  uint8_t otherIndex = txRadioIndex ^ 1;
+  int currentScore = __builtin_popcount(linkHistory[txRadioIndex]);
+  int otherScore = __builtin_popcount(linkHistory[otherIndex]);
+  if(otherScore > currentScore + DIVERSITY_HYSTERESIS) { txRadioIndex = otherIndex; }
+}
+
+void RadioSlave::DispatchReceived()
+{
+  if(receiveCallback != nullptr)
+  {
+    for(int i = 0; i < numberOfReceivePackets; i++)
+    {
+      if(receivePacketsAvailable[i]) { receiveCallback(i, receiveCallbackContext); }
+    }
+  }
+}
+
+bool RadioSlave::StartTask(BaseType_t core, UBaseType_t priority, uint32_t stackSize)
+{
+  if(radioTask != nullptr) { return false; }
+  return xTaskCreatePinnedToCore(RadioTask, "RadioSlave", stackSize, this, priority, &radioTask, core) == pdPASS;
+}
+
+void RadioSlave::RadioTask(void* instance)
+{
+  RadioSlave* self = static_cast<RadioSlave*>(instance);
+  while(true)
+  {
+    self->WaitAndSend();
+    self->Receive();
+  }
+}
+
+void RadioSlave::EnableLatencyStats()
+{
+  isLatencyEnabled = true;
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+  ResetLatencyStats();
+}
+
+void RadioSlave::EnableTimeSync()
+{
+  isTimeSyncEnabled = true;
+  linkUncertainty = TIMESYNC_INVALID;
+  hasMasterSendTime = false;
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+}
+
+void RadioSlave::EnablePowerControl(uint8_t targetPercent)
+{
+  isPowerControlEnabled = true;
+  powerTargetPercent = (targetPercent > 100) ? 100 : targetPercent;
+  linkQuality.Reset();
+  powerController.Reset(maxPowerLevel, powerTargetPercent);
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+}
+
+void RadioSlave::ApplyPowerLevel(bool hasChanged)
+{
+  if(!hasChanged) { return; }
+  //Either radio may be the one transmitting next frame
+  radio.setPALevel(powerController.GetLevel());
+  if(isDiversityEnabled) { diversityRadio.setPALevel(powerController.GetLevel()); }
+  RADIO_TRACE_EVENT(TRACE_SOURCE_SLAVE | TRACE_POWER, powerController.GetLevel(), powerController.GetPeerDeliveryPercent());
+}
+
+void RadioSlave::EnableSequenceNumbers()
+{
+  isSequenceEnabled = true;
+  UpdateHeaderSizes();
+  ClearSendPackets();
+  ClearReceivePackets();
+  ResetSequenceStats();
+}
+
+void RadioSlave::UpdateHeaderSizes()
+{
+  sequenceOffset = 1 + (isLatencyEnabled ? 2 : 0);
+  headerSize = sequenceOffset + (isSequenceEnabled ? 1 : 0);
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    bool hasTimeSync = isTimeSyncEnabled && i == PACKET1;
+    uint8_t powerReportSize = (isPowerControlEnabled && i == PACKET1) ? POWER_REPORT_BYTES : 0;  //Last in the header
+    sendHeaderSize[i] = headerSize + (hasTimeSync ? TIMESYNC_SLAVE_BYTES : 0) + powerReportSize;
+    receiveHeaderSize[i] = headerSize + (hasTimeSync ? TIMESYNC_MASTER_BYTES : 0) + powerReportSize;
+  }
 }
 
+void RadioSlave::ResetLatencyStats()
+{
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    latencyHistograms[i].Reset(microsPerFrame / 16);
+  }
+}
 
+uint32_t RadioSlave::GetLatencyPercentileMicros(uint8_t packetId, uint8_t percent)
+{
+  if(packetId >= MAXPACKETS) { return 0; }
+  return latencyHistograms[packetId].Percentile(percent);
+}
+
+uint32_t RadioSlave::GetMaxLatencyMicros(uint8_t packetId)
+{
+  if(packetId >= MAXPACKETS) { return 0; }
+  return latencyHistograms[packetId].GetMax();
+}
+
+void RadioSlave::ResetSequenceStats()
+{
+  for(int i = 0; i < MAXPACKETS; i++)
+  {
+    sequenceTrackers[i].Reset();
+  }
+}
+
+SequenceStats RadioSlave::GetSequenceStats(uint8_t packetId)
+{
+  if(packetId >= MAXPACKETS) { SequenceStats empty = {}; return empty; }
+  return sequenceTrackers[packetId].GetStats();
+}
+
+uint8_t RadioSlave::GetReceivedPayload(uint8_t packetId, uint8_t* buffer)
+{
+  if(packetId >= numberOfReceivePackets || !receivePacketsAvailable[packetId]) { return 0; }
+  uint8_t length = packetSize - receiveHeaderSize[packetId];
+  memcpy(buffer, &recievePackets[packetId][receiveHeaderSize[packetId]], length);
+  return length;
+}
+
+void RadioSlave::SetSendPayload(uint8_t packetId, const uint8_t* payload, uint8_t length)
+{
+  if(packetId >= numberOfSendPackets) { return; }
+  uint8_t maxLength = packetSize - sendHeaderSize[packetId];
+  if(length > maxLength) { length = maxLength; }
+  if(byteAddCounter[packetId] == sendHeaderSize[packetId]) { StampEnqueue(packetId); }
+  memcpy(&sendPackets[packetId][sendHeaderSize[packetId]], payload, length);
+  byteAddCounter[packetId] = sendHeaderSize[packetId] + length;
+}
+
+void RadioSlave::StampEnqueue(uint8_t packetId)
+{
+  if(!isLatencyEnabled) { return; }
+  sendEnqueueTime[packetId] = micros();
+  isSendStamped[packetId] = true;
+}
+
+void RadioSlave::WriteLatencyHeader(uint8_t* packet, uint8_t packetId)
+{
+  //Age is relative to the frame start rather than the send time, so the receiver only needs the shared frame clock.
+  //Data added by the fill callback is younger than the frame start and goes out as a negative age
+  int16_t age = LATENCY_NO_DATA;
+  if(isSendStamped[packetId])
+  {
+    int32_t ageMicros = (int32_t)(currentFrameStart - sendEnqueueTime[packetId]) / (1 << LATENCY_AGE_SHIFT);
+    age = (ageMicros < -32768) ? -32768 : ((ageMicros >= LATENCY_NO_DATA) ? LATENCY_NO_DATA - 1 : ageMicros);
+  }
+  memcpy(&packet[1], &age, sizeof(age));
+}
+
+void RadioSlave::RecordLatency(uint8_t packetId, const uint8_t* packet, uint32_t remoteFrameStart)
+{
+  int16_t age;
+  memcpy(&age, &packet[1], sizeof(age));
+  if(age == LATENCY_NO_DATA) { return; }
+
+  int32_t latency = (int32_t)(micros() - remoteFrameStart) + (int32_t)age * (1 << LATENCY_AGE_SHIFT);
+  latencyHistograms[packetId].Add((latency < 0) ? 0 : latency);
+}
+
+void RadioSlave::ReadMasterTimeSync(const uint8_t* packet)
+{
+  //The sync time stamp is already moved back to when PACKET1 landed
+  uint32_t irqTimeStamp = syncIrqTimeStamp;
+  if(micros() - irqTimeStamp <= microsPerFrame)
+  {
+    memcpy(&masterSendTime, &packet[headerSize], sizeof(masterSendTime));
+    masterReceiveTime = irqTimeStamp;
+    hasMasterSendTime = true;
+  }
+
+  //The offset the Master measured from our last reply
+  uint32_t offset;
+  uint16_t uncertainty;
+  memcpy(&offset, &packet[headerSize + 4], sizeof(offset));
+  memcpy(&uncertainty, &packet[headerSize + 8], sizeof(uncertainty));
+  if(uncertainty == TIMESYNC_INVALID) { return; }
+  linkOffset = offset;
+  linkUncertainty = uncertainty;
+  linkSampleTime = micros();
+}
+
+void RadioSlave::WriteTimeSyncHeader(uint8_t* packet)
+{
+  //Taken just before writeFast, as the Master takes its send time, so the two radio pipelines match
+  uint32_t holdTime = micros() - masterReceiveTime;
+  if(!hasMasterSendTime || holdTime >= 1000000) { holdTime = TIMESYNC_NO_SAMPLE; }  //Crystal drift over a longer hold would show in the offset
+  memcpy(&packet[headerSize], &masterSendTime, sizeof(masterSendTime));
+  memcpy(&packet[headerSize + 4], &masterReceiveTime, sizeof(masterReceiveTime));
+  memcpy(&packet[headerSize + 8], &holdTime, sizeof(holdTime));
+}
+
+bool RadioSlave::IsLinkTimeValid()
+{
+  return linkUncertainty != TIMESYNC_INVALID && (micros() - linkSampleTime) < 1000000;
+}
+
+uint16_t RadioSlave::GetLinkTimeUncertaintyMicros()
+{
+  return IsLinkTimeValid() ? linkUncertainty : TIMESYNC_INVALID;
+}
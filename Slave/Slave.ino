@@ -9,13 +9,15 @@
 #define PACKET_SIZE 32              // Max 32 Bytes. Must match the Master's Packet Size. How many bytes you are maximum packing into each packet. Useable size is 1 less than this as first byte is PacketID and Hopping information
 #define NUMBER_OF_SENDPACKETS 2     // Max of 3 Packets. How many packets per frame the slave will send. The master needs to have the same amount of receive packets
 #define NUMBER_OF_RECEIVE_PACKETS 2 // Max of 3 Packets. How many packets per frame the slave will receive. The Master needs to have the same amount of send packets
-#define FRAME_RATE 50               // Locked frame rate of the microcontroller. Must match the Master's Framerate
+#define FRAME_RATE 50               // Locked frame rate of the microcontroller, 10 to 500. Must match the Master's Framerate
 
-RadioSlave radio;
+StaticRadioSlave<PACKET_SIZE, NUMBER_OF_SENDPACKETS, NUMBER_OF_RECEIVE_PACKETS> radio;  // Buffers are held inside the object, no heap use
 int16_t masterRecPerSecond;
 uint32_t masterMicros;
 uint16_t value2;
 uint8_t value3;
+// PreferencesLinkStorage storage;  // For the optional binding in setup
+// LinkParameters link;
 
 void setup() {
     Serial.begin(115200);
@@ -25,45 +27,97 @@ void setup() {
     // Generate the channels with lower bound, upper bound, and a seed value
     radio.GenerateChannels(76, 124, 12345);
 
-    // Init must be called first with the following defined Parameters
-    radio.Init(&SPI, CE_PIN, CS_PIN, IRQ_PIN, POWER_LEVEL, PACKET_SIZE, NUMBER_OF_SENDPACKETS, NUMBER_OF_RECEIVE_PACKETS, FRAME_RATE);
+    // Init must be called first with the following defined Parameters. Packet size and counts come from the template above
+    // A plain RadioSlave takes them at runtime instead: Init(&SPI, CE_PIN, CS_PIN, IRQ_PIN, POWER_LEVEL, PACKET_SIZE, NUMBER_OF_SENDPACKETS, NUMBER_OF_RECEIVE_PACKETS, FRAME_RATE)
+    radio.Init(&SPI, CE_PIN, CS_PIN, IRQ_PIN, POWER_LEVEL, FRAME_RATE);
 
-    // Create the Slave task on Core 1, Wifi/BT runs on Core 0
-    xTaskCreatePinnedToCore(slaveTask, "SlaveTask", 4096, NULL, 1, NULL, 1);
+    // Optional. Bind instead of using the fixed addresses and seed above. The first power on waits for a Master's offer,
+    // after that the link is loaded from flash along with the frame time last tracked against that Master. storage.Clear() to bind again
+    // if (!storage.Load(link)) {
+    //     while (!radio.Bind(link, 10000)) {}
+    //     storage.Save(link);
+    // }
+    // radio.UseLink(link);
+    // radio.Init(&SPI, CE_PIN, CS_PIN, IRQ_PIN, POWER_LEVEL, link.frameRate);
+
+    // Optional. A second NRF on its own CE, CS and IRQ pins for receive diversity, ideally with its antenna facing another way
+    // radio.InitDiversity(&SPI, CE2_PIN, CS2_PIN, IRQ2_PIN);
+
+    // Optional. Measures how long data takes from AddNextPacketValue on the Master to arriving here. Must also be enabled on the Master
+    // radio.EnableLatencyStats();
+
+    // Optional. Counts lost and repeated packets exactly and drops late copies. Must also be enabled on the Master
+    // radio.EnableSequenceNumbers();
+
+    // Optional. Steps the PA level between 0 and POWER_LEVEL to keep 95% of our packets reaching the Master. Must also be enabled on the Master
+    // radio.EnablePowerControl(95);
+
+    // Optional. For battery nodes, keeps the radio in standby outside the Master's burst and our reply once locked.
+    // Passing true as well light sleeps the ESP32 between frames, which also pauses the status task below
+    // radio.EnableLowPower(LOWPOWER_DEFAULT_GUARD_MICROS);
+
+    // The radio runs its own high priority task on Core 1, Wifi/BT runs on Core 0
+    radio.OnReceive(ProcessReceived);   // Method below to process received data
+    radio.OnFillFrame(AddSendData);     // Method below to add Send data, called right before each send
+
+    // Printing is kept out of the radio task. The status task is woken after every frame
+    TaskHandle_t statusTask;
+    xTaskCreatePinnedToCore(slaveStatusTask, "SlaveStatus", 4096, NULL, 1, &statusTask, 1);
+    radio.SetNotifyTask(statusTask);
+    radio.StartTask(1);
 }
 
-void slaveTask(void *pvParameters) {
-    Serial.println("Slave Task On: " + String(xPortGetCoreID()) + " | " + String(ESP.getCpuFreqMHz()) + "MHz");
+void slaveStatusTask(void *pvParameters) {
+    Serial.println("Slave Status Task On: " + String(xPortGetCoreID()) + " | " + String(ESP.getCpuFreqMHz()) + "MHz");
     while (1) {
-        radio.WaitAndSend();    // Must be called at the start of every frame. Is blocking until the frame time is up
-        radio.Receive();        // Call this second on every Frame
-        
-        ProcessReceived();      // Method below to process received data
-        AddSendData();          // Method below to add Send data
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // Wait for the radio task to finish a frame
+
+#ifdef RADIO_TRACE
+        // Send 't' to dump the frame trace as binary, decode it with tools/decode_trace.py
+        if (Serial.available() && Serial.read() == 't') {
+            RadioTraceDump(Serial);
+        }
+#endif
 
         if (radio.IsSecondTick()) {
+            // With binding, keeps the tracked frame time for a warm start. Writes once after lock, then only when it
+            // moved by 0.05% and at most every 10 minutes
+            // radio.StoreFrameTime(storage, link);
+
             // Print out received data in a human-readable format
             String dataString = "---- Slave Received Data ----\n";
             dataString += "Slave/Master Rec. Per Second: " + String(radio.GetRecievedPacketsPerSecond()) + " | " + String(masterRecPerSecond) + "\n";
             dataString += "Received Microseconds: " + String(masterMicros) + "\n";
             dataString += "Received 16-bit value: " + String(value2) + "\n";
             dataString += "Received 8-bit value: " + String(value3) + "\n";
+            dataString += "Lock Recoveries/Avg ms: " + String(radio.GetRecoveryCount()) + " | " + String(radio.GetAverageRecoveryMicros() / 1000) + "\n";
+            dataString += "Packet1 Latency p50/p99/max us: " + String(radio.GetLatencyPercentileMicros(PACKET1, 50)) + " | " + String(radio.GetLatencyPercentileMicros(PACKET1, 99)) + " | " + String(radio.GetMaxLatencyMicros(PACKET1)) + "\n";
+            dataString += "Packet1 Lost/Dup/Longest Gap: " + String(radio.GetSequenceStats(PACKET1).lost) + " | " + String(radio.GetSequenceStats(PACKET1).duplicates) + " | " + String(radio.GetSequenceStats(PACKET1).longestGap) + "\n";
+            dataString += "Radio On Per 1000: " + String(radio.GetRadioDutyPermille()) + "\n";
+            dataString += "PA Level/Peer Delivery %/Changes: " + String(radio.GetPowerLevel()) + " | " + String(radio.GetPeerDeliveryPercent()) + " | " + String(radio.GetPowerChanges()) + "\n";
+#ifdef RADIO_PROFILE
+            // Average and worst case time of each phase of the radio task, the wait is the headroom left in the frame
+            const char *phaseNames[PROFILE_PHASES] = {"Wait", "Fill", "Send", "Hop", "Receive", "Clear"};
+            for (uint8_t phase = 0; phase < PROFILE_PHASES; phase++) {
+                ProfileStats stats = radio.GetProfile(phase);
+                dataString += String(phaseNames[phase]) + " avg/max us: " + String(stats.AverageCycles() / RadioCyclesPerMicro()) + " | " + String(stats.maxCycles / RadioCyclesPerMicro()) + "\n";
+            }
+            radio.ResetProfile();
+#endif
             dataString += "----------------------------\n";
             
             // Print the entire string at once
             Serial.print(dataString);
         }
-
-        vTaskDelay(1);  // Yield to allow other tasks to run
     }
 }
 
-void AddSendData() {
+// Both callbacks run on the radio task so keep them short. ProcessReceived runs first, so this frame's reply can answer the Master
+void AddSendData(void *context) {
     int16_t slaveRecPerSecond = radio.GetRecievedPacketsPerSecond();  // Get the number of Packets we are receiving per second
     int16_t number16Bit = 23145;      // Useless variable we will send
     uint8_t numberU8Bit = 50;         // Useless variable we will send
     float numberFloat = 302.234f;     // Useless variable we will send
-    uint32_t numberU32Bit = 2342521;  // Useless variable we will send
 
     // Add data to Packet 1. We can add 1 less byte than packet byte size
     radio.AddNextPacketValue(PACKET1, slaveRecPerSecond);
@@ -72,15 +126,15 @@ void AddSendData() {
 
     // Add data to Packet 2. We can add 1 less byte than packet byte size
     radio.AddNextPacketValue(PACKET2, numberFloat);
-    radio.AddNextPacketValue(PACKET2, numberU32Bit);
+    radio.AddNextPacketValue(PACKET2, masterMicros);  // Echo the Master's time from this frame's burst, it times the round trip with it
 }
 
-void ProcessReceived() {
-    // Must call IsNewPacket before processing
+void ProcessReceived(uint8_t packetId, void *context) {
+    // Called once for every packet that arrived this frame
     // Packet contents must be processed in the order they were sent from the Master
     // On receiving, the template also Requires a typecast to the type we are retrieving eg <int16_t>
 
-    if (radio.IsNewPacket(PACKET1)) {  // Call to see if there's new values for Packet1
+    if (packetId == PACKET1) {
         masterRecPerSecond = radio.GetNextPacketValue<int16_t>(PACKET1);
         masterMicros = radio.GetNextPacketValue<uint32_t>(PACKET1);
         value2 = radio.GetNextPacketValue<uint16_t>(PACKET1);
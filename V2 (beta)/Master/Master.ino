@@ -82,6 +82,11 @@ void AddSendData() {
     radio.AddNextPacketValue(PACKET1, masterMicros);
     radio.AddNextPacketValue(PACKET1, value2);
     radio.AddNextPacketValue(PACKET1, value3);
+
+    // Publish hands the finished packet to the radio without waiting on it. This can be done from any task,
+    // the radio always sends the most recently published packet. Other tasks can use ReadPacket to take
+    // a snapshot of the latest received packet the same way
+    radio.PublishPacket(PACKET1);
 }
 
 void ProcessReceived() {
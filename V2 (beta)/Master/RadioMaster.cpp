@@ -9,17 +9,11 @@ void RadioMaster::Init(_SPI *spiPort, uint8_t pinCE, uint8_t PinCS, int8_t power
     this->packetSize = (packetSize < 1) ? 1 : ((packetSize > 32) ? 32 : packetSize);
     powerLevel = (powerLevel < 0) ? 0 : ((powerLevel > 3) ? 3 : powerLevel);
 
-    for (int i = 0; i < numberOfSendPackets; ++i)
-    {
-        sendPackets[i] = new uint8_t[packetSize]();
-    }
-
     for (int i = 0; i < numberOfReceivePackets; ++i)
     {
         receivePackets[i] = new uint8_t[packetSize]();
     }
 
-    ClearSendPackets();
     ClearReceivePackets();
 
     spiPort->begin();
@@ -43,15 +37,6 @@ void RadioMaster::Init(_SPI *spiPort, uint8_t pinCE, uint8_t PinCS, int8_t power
     microsPerFrame = 1000000 / frameRate;
 }
 
-void RadioMaster::ClearSendPackets()
-{
-    for (int i = 0; i < numberOfSendPackets; i++)
-    {
-        memset(sendPackets[i], 0, packetSize);
-        byteAddCounter[i] = 1;
-    }
-}
-
 void RadioMaster::ClearReceivePackets()
 {
     for (int i = 0; i < numberOfReceivePackets; i++)
@@ -103,19 +88,25 @@ void RadioMaster::UpdateRecording()
 
 void RadioMaster::WaitAndSend()
 {
-    xSemaphoreTake(radioMutex, portMAX_DELAY);
     while (!IsFrameReady())
     {
         taskYIELD();
     }
+    xSemaphoreTake(radioMutex, portMAX_DELAY);
 
     radio.stopListening();
 
     for (int i = 0; i < numberOfSendPackets; i++)
     {
-        sendPackets[i][0] = i;
-        sendPackets[i][0] |= ((channelHopCounter << 5) & 0xE0);
-        radio.write(sendPackets[i], packetSize);
+        bool isFresh;
+        uint8_t *packet = sendStages[i].AcquireFront(isFresh);
+        packet[0] = i;
+        packet[0] |= ((channelHopCounter << 5) & 0xE0);
+        if (!isFresh)
+        {
+            packet[0] |= STAGE_REPEAT;  // Still sent for the Slave's sync, but it won't be delivered again
+        }
+        radio.write(packet, packetSize);
     }
 
     channelHopCounter++;
@@ -131,7 +122,6 @@ void RadioMaster::WaitAndSend()
     }
 
     radio.startListening();
-    ClearSendPackets();
     xSemaphoreGive(radioMutex);
 }
 
@@ -149,7 +139,12 @@ void RadioMaster::Receive()
             radio.read(currentPacket, packetSize);
             uint8_t firstByte = currentPacket[0];
             uint8_t packetId = firstByte & 0x03;
+            if (firstByte & STAGE_REPEAT)
+            {
+                continue;  // Nothing new was published since the last one
+            }
             memcpy(receivePackets[packetId], currentPacket, packetSize);
+            receiveStages[packetId].Write(currentPacket, packetSize);
             receivePacketsAvailable[packetId] = true;
         }
     }
@@ -157,3 +152,21 @@ void RadioMaster::Receive()
     UpdateRecording();
     xSemaphoreGive(radioMutex);
 }
+
+void RadioMaster::PublishPacket(uint8_t packetId)
+{
+    if (packetId >= MAXPACKETS)
+    {
+        return;
+    }
+    sendStages[packetId].Publish();
+}
+
+bool RadioMaster::ReadPacket(uint8_t packetId, PacketSnapshot &snapshot)
+{
+    if (packetId >= MAXPACKETS)
+    {
+        return false;
+    }
+    return receiveStages[packetId].Read(snapshot);
+}
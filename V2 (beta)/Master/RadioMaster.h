@@ -5,6 +5,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include "PacketStage.h"
 
 #define MAXPACKETS 3
 #define PACKET1 0
@@ -38,15 +39,16 @@ private:
     uint8_t numberOfSendPackets = 0;
     uint8_t numberOfReceivePackets = 0;
     uint8_t *receivePackets[MAXPACKETS];
-    uint8_t *sendPackets[MAXPACKETS];
     bool receivePacketsAvailable[MAXPACKETS];
-    uint8_t byteAddCounter[MAXPACKETS];
     uint8_t byteReceiveCounter[MAXPACKETS];
     uint8_t packetSize = 0;
 
+    // Lock free hand over between application tasks and the radio task
+    SendStage sendStages[MAXPACKETS];
+    ReceiveStage receiveStages[MAXPACKETS];
+
     SemaphoreHandle_t radioMutex;
 
-    void ClearSendPackets();
     void ClearReceivePackets();
     void UpdateRecording();
     void AdvanceFrame();
@@ -61,6 +63,11 @@ public:
     int8_t GetCurrentChannel() { return channelList[currentChannelIndex]; }
     bool IsSecondTick() { return isSecondTick; }
 
+    // Safe to call from any task at any time, neither blocks on the radio.
+    // Each packet should be filled and published by only one task
+    void PublishPacket(uint8_t packetId);
+    bool ReadPacket(uint8_t packetId, PacketSnapshot &snapshot);
+
     template <typename T>
     void AddNextPacketValue(uint8_t packetId, T data);
     template <typename T>
@@ -76,14 +83,15 @@ void RadioMaster::AddNextPacketValue(uint8_t packetId, T data)
         return;
     }
 
-    if (byteAddCounter[packetId] + dataLength > packetSize)
+    uint8_t &byteAddCounter = sendStages[packetId].AddCounter();
+    if (byteAddCounter + dataLength > packetSize)
     {
         return;
     }
 
-    memcpy(&sendPackets[packetId][byteAddCounter[packetId]], &data, dataLength);
+    memcpy(&sendStages[packetId].Back()[byteAddCounter], &data, dataLength);
 
-    byteAddCounter[packetId] += dataLength;
+    byteAddCounter += dataLength;
 }
 
 template <typename T>
@@ -0,0 +1,113 @@
+#ifndef PacketStage_h
+#define PacketStage_h
+
+#include <Arduino.h>
+#include <atomic>
+
+#define STAGE_PACKET_SIZE 32
+#define STAGE_FRESH 0x80
+#define STAGE_INDEX_MASK 0x03
+#define STAGE_REPEAT 0x04  // Set in byte 0 of a packet resent because nothing newer was published
+
+// Copy of a received packet taken by ReadPacket. Values are read back in the order they were added
+struct PacketSnapshot
+{
+    uint8_t data[STAGE_PACKET_SIZE] = {0};
+    uint32_t sequence = 0;
+    uint8_t readCounter = 1;
+
+    template <typename T>
+    T GetNextValue()
+    {
+        size_t dataLength = sizeof(T);
+
+        if (readCounter + dataLength > STAGE_PACKET_SIZE)
+        {
+            return 0;
+        }
+
+        T value;
+        memcpy(&value, &data[readCounter], dataLength);
+        readCounter += dataLength;
+        return value;
+    }
+};
+
+// Triple buffer for one outgoing packet. A single producer task fills the back buffer and publishes it,
+// the radio task picks up the most recently published buffer. Neither side ever waits on the other.
+class SendStage
+{
+private:
+    uint8_t buffers[3][STAGE_PACKET_SIZE] = {{0}};
+    std::atomic<uint8_t> middle{1};
+    uint8_t back = 2;   // Owned by the producer
+    uint8_t front = 0;  // Owned by the radio task
+    uint8_t addCounter = 1;
+
+public:
+    uint8_t *Back() { return buffers[back]; }
+    uint8_t &AddCounter() { return addCounter; }
+
+    void Publish()
+    {
+        back = middle.exchange(back | STAGE_FRESH, std::memory_order_acq_rel) & STAGE_INDEX_MASK;
+        memset(buffers[back], 0, STAGE_PACKET_SIZE);
+        addCounter = 1;
+    }
+
+    // Returns the latest complete packet. Keeps returning the same one until a newer one is published,
+    // isFresh says whether this one has been handed out before
+    uint8_t *AcquireFront(bool &isFresh)
+    {
+        isFresh = (middle.load(std::memory_order_relaxed) & STAGE_FRESH) != 0;
+        if (isFresh)
+        {
+            front = middle.exchange(front, std::memory_order_acq_rel) & STAGE_INDEX_MASK;
+        }
+        return buffers[front];
+    }
+};
+
+// Seqlock for one incoming packet. The radio task writes, any number of tasks can take snapshots
+class ReceiveStage
+{
+private:
+    uint8_t data[STAGE_PACKET_SIZE] = {0};
+    std::atomic<uint32_t> sequence{0};
+
+public:
+    void Write(const uint8_t *packet, uint8_t length)
+    {
+        uint32_t current = sequence.load(std::memory_order_relaxed);
+        sequence.store(current + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(data, packet, length);
+        sequence.store(current + 2, std::memory_order_release);
+    }
+
+    // Returns false if there is nothing newer than the snapshot already holds, or the radio task is
+    // part way through writing it. Never spins waiting on the writer
+    bool Read(PacketSnapshot &snapshot)
+    {
+        while (true)
+        {
+            uint32_t before = sequence.load(std::memory_order_acquire);
+            if ((before & 1) || before == snapshot.sequence)
+            {
+                return false;
+            }
+
+            memcpy(snapshot.data, data, STAGE_PACKET_SIZE);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (sequence.load(std::memory_order_relaxed) == before)
+            {
+                snapshot.sequence = before;
+                snapshot.readCounter = 1;
+                return true;
+            }
+        }
+    }
+};
+
+#endif
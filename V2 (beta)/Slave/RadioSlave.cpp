@@ -1,10 +1,7 @@
 #include "RadioSlave.h"
 
-RadioSlave *RadioSlave::handlerInstance = nullptr;
-
 void RadioSlave::Init(_SPI *spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIRQ, int8_t powerLevel, uint8_t packetSize, uint8_t numberOfSendPackets, uint8_t numberOfReceivePackets, uint8_t frameRate)
 {
-    handlerInstance = this;
     radioMutex = xSemaphoreCreateMutex();
 
     this->numberOfSendPackets = (numberOfSendPackets < 0) ? 0 : ((numberOfSendPackets > 3) ? 3 : numberOfSendPackets);
@@ -12,17 +9,11 @@ void RadioSlave::Init(_SPI *spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIR
     this->packetSize = (packetSize < 1) ? 1 : ((packetSize > 32) ? 32 : packetSize);
     powerLevel = (powerLevel < 0) ? 0 : ((powerLevel > 3) ? 3 : powerLevel);
 
-    for (int i = 0; i < numberOfSendPackets; ++i)
-    {
-        sendPackets[i] = new uint8_t[packetSize]();
-    }
-
     for (int i = 0; i < numberOfReceivePackets; ++i)
     {
         receivePackets[i] = new uint8_t[packetSize]();
     }
 
-    ClearSendPackets();
     ClearReceivePackets();
 
     spiPort->begin();
@@ -42,7 +33,7 @@ void RadioSlave::Init(_SPI *spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIR
     radio.powerUp();
     radio.startListening();
 
-    attachInterrupt(digitalPinToInterrupt(pinIRQ), StaticIRQHandler, FALLING);
+    attachInterruptArg(digitalPinToInterrupt(pinIRQ), StaticIRQHandler, this, FALLING); // Per instance, several radios can share the MCU
 
     this->frameRate = (frameRate < 10) ? 10 : ((frameRate > 120) ? 120 : frameRate);
     microsPerFrame = 1000000 / frameRate;
@@ -52,17 +43,12 @@ void RadioSlave::Init(_SPI *spiPort, uint8_t pinCE, uint8_t pinCS, uint8_t pinIR
     syncDelay = microsPerFrame / 8;
 }
 
-void RadioSlave::StaticIRQHandler()
+void IRAM_ATTR RadioSlave::StaticIRQHandler(void *instance)
 {
-    if (handlerInstance != nullptr)
-    {
-        handlerInstance->IRQHandler();
-    }
+    static_cast<RadioSlave *>(instance)->IRQHandler();
 }
 
-volatile uint32_t lastInterruptTimeStamp = 0;
-
-void RadioSlave::IRQHandler()
+void IRAM_ATTR RadioSlave::IRQHandler()
 {
     interruptTimeStamp = micros() + syncDelay;
 
@@ -75,15 +61,6 @@ void RadioSlave::IRQHandler()
     lastInterruptTimeStamp = interruptTimeStamp;
 }
 
-void RadioSlave::ClearSendPackets()
-{
-    for (int i = 0; i < numberOfSendPackets; i++)
-    {
-        memset(sendPackets[i], 0, packetSize);
-        byteAddCounter[i] = 1;
-    }
-}
-
 void RadioSlave::ClearReceivePackets()
 {
     for (int i = 0; i < numberOfReceivePackets; i++)
@@ -275,11 +252,11 @@ bool RadioSlave::UpdateHop()
 
 void RadioSlave::WaitAndSend()
 {
-    xSemaphoreTake(radioMutex, portMAX_DELAY);
     while (!IsFrameReady())
     {
         taskYIELD();
     }
+    xSemaphoreTake(radioMutex, portMAX_DELAY);
 
     bool hasStoppedListening = UpdateHop();
     if (radioState == STATE_FULL_LOCK)
@@ -291,8 +268,14 @@ void RadioSlave::WaitAndSend()
         }
         for (int i = 0; i < numberOfSendPackets; i++)
         {
-            sendPackets[i][0] = i;
-            radio.write(sendPackets[i], packetSize);
+            bool isFresh;
+            uint8_t *packet = sendStages[i].AcquireFront(isFresh);
+            packet[0] = i;
+            if (!isFresh)
+            {
+                packet[0] |= STAGE_REPEAT;
+            }
+            radio.write(packet, packetSize);
         }
     }
 
@@ -301,7 +284,6 @@ void RadioSlave::WaitAndSend()
         radio.startListening();
     }
 
-    ClearSendPackets();
     xSemaphoreGive(radioMutex);
 }
 
@@ -322,10 +304,15 @@ void RadioSlave::Receive()
             radio.read(currentPacket, packetSize);
             uint8_t firstByte = currentPacket[0];
             uint8_t packetId = firstByte & 0x03;
-            memcpy(receivePackets[packetId], currentPacket, packetSize);
-            receivePacketsAvailable[packetId] = true;
             uint8_t txChannelHopCounter = (firstByte & 0xE0) >> 5;
             channelHopCounter = txChannelHopCounter;
+            if (firstByte & STAGE_REPEAT)
+            {
+                continue;  // Keeps us in sync, but nothing new was published since the last one
+            }
+            memcpy(receivePackets[packetId], currentPacket, packetSize);
+            receiveStages[packetId].Write(currentPacket, packetSize);
+            receivePacketsAvailable[packetId] = true;
         }
     }
 
@@ -333,3 +320,21 @@ void RadioSlave::Receive()
     UpdateSecondCounter();
     xSemaphoreGive(radioMutex);
 }
+
+void RadioSlave::PublishPacket(uint8_t packetId)
+{
+    if (packetId >= MAXPACKETS)
+    {
+        return;
+    }
+    sendStages[packetId].Publish();
+}
+
+bool RadioSlave::ReadPacket(uint8_t packetId, PacketSnapshot &snapshot)
+{
+    if (packetId >= MAXPACKETS)
+    {
+        return false;
+    }
+    return receiveStages[packetId].Read(snapshot);
+}
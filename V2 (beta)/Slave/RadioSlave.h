@@ -5,6 +5,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include "PacketStage.h"
 
 #define MAXPACKETS 3
 #define PACKET1 0
@@ -18,7 +19,6 @@
 class RadioSlave
 {
 private:
-    static RadioSlave *handlerInstance;
     RF24 radio;
     int8_t channelList[40] = {15, 102, 87, 62, 95, 33, 100, 78, 81, 92, 26, 39, 105, 12, 36, 96, 60, 84, 21, 48, 90, 27, 75, 9, 70, 93, 18, 102, 81, 30, 63, 108, 48, 57, 36, 99, 78, 87, 38, 25};
     const uint8_t addressRec[4] = {'R', 'R', 'R', '\0'};
@@ -48,24 +48,26 @@ private:
     uint8_t numberOfSendPackets = 0;
     uint8_t numberOfReceivePackets = 0;
     uint8_t *receivePackets[MAXPACKETS];
-    uint8_t *sendPackets[MAXPACKETS];
     bool receivePacketsAvailable[MAXPACKETS];
-    uint8_t byteAddCounter[MAXPACKETS];
     uint8_t byteReceiveCounter[MAXPACKETS];
     uint8_t packetSize = 0;
 
+    // Lock free hand over between application tasks and the radio task
+    SendStage sendStages[MAXPACKETS];
+    ReceiveStage receiveStages[MAXPACKETS];
+
     int16_t totalAdjustedDrift = 0;
     uint32_t syncDelay = 0;
     uint32_t minOverflowProtection;
     uint32_t maxOverflowProtection;
     uint8_t partialLockCounter = 0;
     volatile uint8_t radioState = STATE_SCANNING;
-    volatile bool isSyncFrame;
+    volatile bool isSyncFrame = false;
     volatile uint32_t interruptTimeStamp = 0;
+    volatile uint32_t lastInterruptTimeStamp = 0;
 
     SemaphoreHandle_t radioMutex;
 
-    void ClearSendPackets();
     void ClearReceivePackets();
     void UpdateScanning(bool isSuccess);
     void UpdateSecondCounter();
@@ -74,7 +76,7 @@ private:
     bool IsFrameReady();
     void AdjustChannelIndex(int8_t amount);
     bool UpdateHop();
-    static void StaticIRQHandler();
+    static void StaticIRQHandler(void *instance);
     void IRQHandler();
 
 public:
@@ -87,6 +89,11 @@ public:
     int8_t GetCurrentChannel() { return channelList[currentChannelIndex]; }
     bool IsSecondTick() { return isSecondTick; }
 
+    // Safe to call from any task at any time, neither blocks on the radio.
+    // Each packet should be filled and published by only one task
+    void PublishPacket(uint8_t packetId);
+    bool ReadPacket(uint8_t packetId, PacketSnapshot &snapshot);
+
     template <typename T>
     void AddNextPacketValue(uint8_t packetId, T data);
     template <typename T>
@@ -103,14 +110,15 @@ void RadioSlave::AddNextPacketValue(uint8_t packetId, T data)
         return;
     }
 
-    if (byteAddCounter[packetId] + dataLength > packetSize)
+    uint8_t &byteAddCounter = sendStages[packetId].AddCounter();
+    if (byteAddCounter + dataLength > packetSize)
     {
         return;
     }
 
-    memcpy(&sendPackets[packetId][byteAddCounter[packetId]], &data, dataLength);
+    memcpy(&sendStages[packetId].Back()[byteAddCounter], &data, dataLength);
 
-    byteAddCounter[packetId] += dataLength;
+    byteAddCounter += dataLength;
 }
 
 template <typename T>
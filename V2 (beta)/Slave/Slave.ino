@@ -70,6 +70,10 @@ void AddSendData() {
     // Add data to Packet 2. We can add 1 less byte than packet byte size
     radio.AddNextPacketValue(PACKET2, numberFloat);
     radio.AddNextPacketValue(PACKET2, numberU32Bit);
+
+    // Hand the finished packets to the radio. This never blocks and can be done from any task
+    radio.PublishPacket(PACKET1);
+    radio.PublishPacket(PACKET2);
 }
 
 void ProcessReceived() {
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Check that the library files copied into the Slave and Relay folders match their originals.
+
+Arduino only builds the files in a sketch's own folder, so the Relay carries copies of the Master and Slave
+libraries and the Slave its own RadioCommon.h and LinkStorage.h.  Prints a diff for every copy that has drifted
+and exits with 1, so it can run before a commit.
+
+Run: check_relay_copies.py          from anywhere in the repository
+     check_relay_copies.py --fix    copies the originals over the copies that differ
+"""
+
+import argparse
+import difflib
+import os
+import shutil
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Original, copy
+COPIES = (
+    ("Master/RadioCommon.h", "Slave/RadioCommon.h"),
+    ("Master/LinkStorage.h", "Slave/LinkStorage.h"),
+    ("Master/RadioCommon.h", "Relay/RadioCommon.h"),
+    ("Master/LinkStorage.h", "Relay/LinkStorage.h"),
+    ("Master/RadioMaster.h", "Relay/RadioMaster.h"),
+    ("Master/RadioMaster.cpp", "Relay/RadioMaster.cpp"),
+    ("Slave/RadioSlave.h", "Relay/RadioSlave.h"),
+    ("Slave/RadioSlave.cpp", "Relay/RadioSlave.cpp"),
+)
+
+
+def read_lines(path):
+    with open(os.path.join(ROOT, path), newline="") as f:
+        return f.readlines()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--fix", action="store_true", help="overwrite the copies that differ with their originals")
+    args = parser.parse_args()
+
+    drifted = 0
+    for original, copy in COPIES:
+        original_lines = read_lines(original)
+        copy_lines = read_lines(copy)
+        if original_lines == copy_lines:
+            continue
+        drifted += 1
+        if args.fix:
+            shutil.copyfile(os.path.join(ROOT, original), os.path.join(ROOT, copy))
+            print("%s <- %s" % (copy, original))
+        else:
+            sys.stdout.writelines(difflib.unified_diff(original_lines, copy_lines, original, copy))
+
+    if drifted == 0:
+        print("All %d copies match" % len(COPIES))
+    elif not args.fix:
+        print("%d of %d copies differ, run with --fix to copy the originals over them" % (drifted, len(COPIES)))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
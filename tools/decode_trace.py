@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Decode a RadioTraceDump capture into a readable timeline.
+
+Capture the raw serial bytes to a file (eg. with `cat /dev/ttyUSB0 > trace.bin` after sending 't'),
+then run: decode_trace.py trace.bin
+Anything before the "NRFT" marker is skipped, so ordinary serial prints in front of the dump are fine.
+"""
+
+import struct
+import sys
+
+SOURCES = {0x00: "Master", 0x10: "Slave"}
+STATES = {0: "SCANNING", 1: "PARTIAL_LOCK", 2: "FULL_LOCK", 3: "COASTING"}
+
+
+def describe(event, a, b):
+    if event == 1:
+        return "frame start     hop counter %d, channel index %d" % (a, b)
+    if event == 2:
+        return "tx done         %d packets, first bit on air after %d us" % (a, b)
+    if event == 3:
+        return "irq             %s" % ("sync" if a else "ignored")
+    if event == 4:
+        return "rx              packet %d, pipe %d" % (a, b)
+    if event == 5:
+        return "hop             channel index %d, channel %d" % (a, b)
+    if event == 6:
+        return "drift           %+d us" % struct.unpack("<h", struct.pack("<H", b))[0]
+    if event == 7:
+        return "state           %s -> %s" % (STATES.get(a, a), STATES.get(b, b))
+    if event == 8:
+        return "power           PA level %d, peer delivery %d%%" % (a, b)
+    return "event %d        a=%d b=%d" % (event, a, b)
+
+
+def decode(data):
+    start = data.find(b"NRFT")
+    if start < 0:
+        raise SystemExit("No trace dump found")
+    version, event_size, count = struct.unpack_from("<BBH", data, start + 4)
+    if version != 1 or event_size != 8:
+        raise SystemExit("Unsupported trace version %d / event size %d" % (version, event_size))
+
+    offset = start + 8
+    first = None
+    previous = None
+    for _ in range(count):
+        if offset + event_size > len(data):
+            print("-- dump truncated --")
+            break
+        time_stamp, kind, a, b = struct.unpack_from("<IBBH", data, offset)
+        offset += event_size
+        if first is None:
+            first = previous = time_stamp
+        source = SOURCES.get(kind & 0xF0, "src%d" % (kind >> 4))
+        delta = ((time_stamp - previous + 0x80000000) & 0xFFFFFFFF) - 0x80000000  # micros() wraps every 71 minutes
+        print("%10d us  %+7d  %-6s  %s" % ((time_stamp - first) & 0xFFFFFFFF, delta, source, describe(kind & 0x0F, a, b)))
+        previous = time_stamp
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        raise SystemExit("usage: decode_trace.py <capture file>")
+    with open(sys.argv[1], "rb") as capture:
+        decode(capture.read())
@@ -0,0 +1,692 @@
+#!/usr/bin/env python3
+"""Run the hopping schedule through reproducible RF scenarios and compare links.
+
+Models the Master's hop sequence and the Slave's scan, lock and coast states frame by frame, using the same
+hop table generator as RadioCommon.h.  Packets are lost to Wi-Fi bursts, narrowband jammers, path loss and
+collisions with other Master/Slave pairs sharing the band.  Timing drift between the boards is not modelled,
+every link is assumed to be in step once locked.
+
+--hop-sweep compares first lock and loss under interference for several SetHopping lengths and dwells, seeded
+against orthogonal tables.
+
+--power-sweep runs one pair at a range of distances with EnablePowerControl's PA level stepping on both sides,
+against fixed full power, and --power-log prints every level change it makes.
+
+Run: hop_scenarios.py                       every scenario with the default link settings
+     hop_scenarios.py wifi-busy pairs-10    just those
+     hop_scenarios.py --list
+     hop_scenarios.py --hop-sweep
+     hop_scenarios.py --power-sweep --power-log
+"""
+
+import argparse
+import bisect
+import math
+import random
+
+HOP_TABLE_SIZE = 126
+HOP_RESERVED_CHANNEL = 125
+BIND_CHANNEL = 125
+HOP_DEFAULT_SEED = 0x9E3779B9
+WIFI_HALF_WIDTH_MHZ = 11
+
+TX_SETTLE_MICROS = 130
+SPI_LOAD_MICROS = 40
+SCAN_PREDICTED_EVERY = 4
+REPLY_GUARD_MICROS = 100
+
+SCANNING, PARTIAL_LOCK, FULL_LOCK, COASTING = 0, 1, 2, 3
+
+SENSITIVITY_DBM = {250: -94, 1000: -85, 2000: -82}
+POWER_DBM = {0: -18, 1: -12, 2: -6, 3: 0}
+TX_MILLIAMPS = {0: 7.0, 1: 7.5, 2: 9.0, 3: 11.3}  # NRF24L01+ datasheet
+RPD_THRESHOLD_DBM = -64
+
+# PowerController and LinkQualityCounter in RadioCommon.h
+POWER_WINDOW_FRAMES = 32
+POWER_DEFAULT_TARGET = 95
+POWER_STRONG_PERCENT = 90
+POWER_STEP_DOWN_WINDOWS = 4
+POWER_PROBE_WINDOWS = 16
+POWER_PROBE_MAX_WINDOWS = 128
+POWER_SETTLE_WINDOWS = 2
+POWER_REPORT_TIMEOUT_WINDOWS = 4
+
+
+# Hop tables, matching HopRandomNext, MakeHopTableFromList and MakeOrthogonalHopTable in RadioCommon.h
+
+def hop_random_next(state):
+    state ^= (state << 13) & 0xFFFFFFFF
+    state ^= state >> 17
+    state ^= (state << 5) & 0xFFFFFFFF
+    return state
+
+
+def make_hop_table_from_list(channel_list, seed):
+    pool = [c for c in channel_list if c < HOP_RESERVED_CHANNEL][:126] or [HOP_RESERVED_CHANNEL]
+    state = seed if seed != 0 else HOP_DEFAULT_SEED
+    for i in range(len(pool) - 1, 0, -1):
+        state = hop_random_next(state)
+        j = (state * (i + 1)) >> 32
+        pool[i], pool[j] = pool[j], pool[i]
+    return [HOP_RESERVED_CHANNEL] + [pool[(i - 1) % len(pool)] for i in range(1, HOP_TABLE_SIZE)]
+
+
+def make_hop_table(lower, upper, seed):
+    upper = min(upper, 125)
+    lower = min(lower, upper)
+    return make_hop_table_from_list(list(range(lower, upper + 1)), seed)
+
+
+def orthogonal_hop_length(lower, upper):
+    upper = min(upper, BIND_CHANNEL - 1)
+    lower = min(lower, upper)
+    count = upper - lower + 1
+    for p in range(count, 2, -1):
+        if all(p % d for d in range(2, int(p ** 0.5) + 1)):
+            return p
+    return min(count, 2)
+
+
+def hop_address_hash(master_address, slave_address):
+    value = 2166136261
+    for byte in bytes(master_address[:5]) + bytes(slave_address[:5]):
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def make_orthogonal_hop_table(lower, upper, pair_number):
+    upper = min(upper, BIND_CHANNEL - 1)
+    lower = min(lower, upper)
+    length = orthogonal_hop_length(lower, upper)
+    slopes = length - 1 if length > 1 else 1
+    slope = 1 + pair_number % slopes
+    offset = (pair_number // slopes) % length
+    return [lower + (slope * (i % length) + offset) % length for i in range(HOP_TABLE_SIZE)]
+
+
+def wifi_overlaps_channel(wifi_channel, nrf_channel):
+    centre = 84 if wifi_channel == 14 else 7 + 5 * wifi_channel
+    return abs(nrf_channel - centre) <= WIFI_HALF_WIDTH_MHZ
+
+
+# Air time, matching PacketAirtimeMicros and the reply window helpers
+
+def packet_airtime(payload, data_rate):
+    bits = (1 + 5 + payload + 2) * 8 + 9
+    if data_rate == 2000:
+        return (bits + 1) // 2
+    if data_rate == 250:
+        return bits * 4
+    return bits
+
+
+class Link:
+    """One Master/Slave pair and the Slave's lock state."""
+
+    def __init__(self, index, settings, rng, table, channels, distance, phase_micros, start_index):
+        self.index = index
+        self.settings = settings
+        self.table = table
+        self.channels = channels
+        self.distance = distance
+        self.phase = phase_micros
+        self.master_start_index = start_index
+        self.state = SCANNING
+        self.slave_index = rng.randrange(channels)
+        self.hop_counter = 0
+        self.scan_predicted = self.slave_index
+        self.scan_offset = 0
+        self.scan_frame = 0
+        self.failed = 0
+        self.partial = 0
+        self.coast_start = 0
+        self.outage_start = 0
+        self.first_lock = None
+        self.recoveries = []
+        self.master_delivered = 0
+        self.slave_delivered = 0
+        self.locked_frames = 0       # Frames the Slave started in full lock and what it got in them,
+        self.locked_delivered = 0    # so losses from collisions aren't mixed up with time spent scanning
+
+    def master_channel_index(self, frame):
+        return (self.master_start_index + frame // self.settings.frames_per_hop) % self.channels
+
+    def master_hop_counter(self, frame):
+        return frame % self.settings.frames_per_hop
+
+    def set_state(self, new_state, now):
+        if new_state == self.state:
+            return
+        if new_state == SCANNING:
+            self.scan_predicted, self.scan_offset, self.scan_frame = self.slave_index, 0, 0
+        if self.state == FULL_LOCK:
+            self.outage_start = now - self.settings.failed_before_scanning * self.settings.frame_micros
+        elif new_state == FULL_LOCK:
+            if self.first_lock is None:
+                self.first_lock = now
+            else:
+                self.recoveries.append(now - self.outage_start)
+        self.state = new_state
+
+    def update(self, frame, now, heard):
+        """Receive then hop, in the order the Slave's Receive and next WaitAndSend do it."""
+        s = self.settings
+        if heard:
+            self.failed = 0
+            if self.state == SCANNING:
+                self.slave_index = self.master_channel_index(frame)
+                self.hop_counter = self.master_hop_counter(frame)
+                self.set_state(PARTIAL_LOCK, now)
+                self.partial = 0
+            elif self.state == PARTIAL_LOCK:
+                self.partial += 1
+                self.set_state(FULL_LOCK, now)
+            elif self.state == COASTING:
+                self.set_state(FULL_LOCK, now)
+        else:
+            self.failed += 1
+            if self.state == PARTIAL_LOCK:
+                self.partial += 1
+                if self.partial > 10:
+                    self.set_state(SCANNING, now)
+        if self.failed >= s.failed_before_scanning:
+            self.failed = 0
+            if self.state == FULL_LOCK and s.coast_micros > 0:
+                self.coast_start = now
+                self.set_state(COASTING, now)
+            elif self.state != COASTING:
+                self.set_state(SCANNING, now)
+        if self.state == COASTING and now - self.coast_start >= s.coast_micros:
+            self.set_state(SCANNING, now)
+
+        self.hop_counter = (self.hop_counter + 1) % s.frames_per_hop
+        if self.state == SCANNING:
+            # One frame in SCAN_PREDICTED_EVERY on the schedule we last had, the rest sweep the offsets from it
+            if self.hop_counter == 0:
+                self.scan_predicted = (self.scan_predicted + 1) % self.channels
+            self.scan_frame = (self.scan_frame + 1) % SCAN_PREDICTED_EVERY
+            self.slave_index = self.scan_predicted
+            if self.scan_frame != 0:
+                self.scan_offset = self.channels - 1 if self.scan_offset <= 1 else self.scan_offset - 1
+                self.slave_index = (self.scan_predicted + self.scan_offset) % self.channels
+        elif self.hop_counter == 0:
+            self.slave_index = (self.slave_index + 1) % self.channels
+
+
+class Scenario:
+    def __init__(self, description, pairs=1, distance=2.0, wifi=(), jammers=(), power=3, radios=1, blocked=None):
+        self.description = description
+        self.blocked = blocked    # (every ms, for ms) the Master is shadowed but keeps its schedule
+        self.radios = radios      # Slave receive radios, 2 with InitDiversity. Each fades on its own
+        self.pairs = pairs
+        self.distance = distance
+        self.wifi = wifi          # (wifi channel, busy fraction)
+        self.jammers = jammers    # (nrf channel, half width MHz, busy fraction)
+        self.power = power
+
+    def is_blocked(self, micros):
+        if self.blocked is None:
+            return False
+        every, length = self.blocked
+        return (micros // 1000) % every >= every - length
+
+    def interference_loss(self, channel):
+        """Chance a packet on this channel is hit by Wi-Fi or a jammer."""
+        clear = 1.0
+        for wifi_channel, busy in self.wifi:
+            if wifi_overlaps_channel(wifi_channel, channel):
+                clear *= 1.0 - busy
+        for jam_channel, half_width, busy in self.jammers:
+            if abs(channel - jam_channel) <= half_width:
+                clear *= 1.0 - busy
+        return 1.0 - clear
+
+    def path_loss(self, settings, distance, rng):
+        return range_loss(settings, received_dbm(self.power, distance, rng))
+
+
+def received_dbm(power, distance, rng):
+    """Log distance path loss with exponent 3 and 4 dB of shadowing per packet."""
+    return POWER_DBM[power] - (40.0 + 30.0 * math.log10(max(distance, 0.1))) + rng.gauss(0, 4)
+
+
+def range_loss(settings, received):
+    """Chance of losing a packet received at this level."""
+    margin = received - SENSITIVITY_DBM[settings.data_rate]
+    return 1.0 / (1.0 + math.exp(margin / 1.5))
+
+
+SCENARIOS = {
+    "clear": Scenario("One pair, 2 m apart, nothing else on the band"),
+    "wifi-1-6-11": Scenario("Wi-Fi on channels 1, 6 and 11, each busy 30% of the time", wifi=((1, 0.3), (6, 0.3), (11, 0.3))),
+    "wifi-busy": Scenario("Wi-Fi channel 13 streaming, busy 80% of the time", wifi=((13, 0.8),)),
+    "jammer": Scenario("Narrowband carriers parked on channels 90 and 110", jammers=((90, 1, 1.0), (110, 1, 1.0))),
+    "wideband-jammer": Scenario("A 10 MHz wide jammer on channels 95-105, on half the time", jammers=((100, 5, 0.5),)),
+    "range-20m": Scenario("One pair 20 m apart at full power", distance=20.0),
+    "range-30m": Scenario("One pair 30 m apart at full power", distance=30.0),
+    "diversity-20m": Scenario("range-20m with a second Slave radio", distance=20.0, radios=2),
+    "diversity-30m": Scenario("range-30m with a second Slave radio", distance=30.0, radios=2),
+    "blocked-1200ms": Scenario("The Master is shadowed for 1.2 s every 6 s", blocked=(6000, 1200)),
+    "blocked-1800ms": Scenario("The Master is shadowed for 1.8 s every 6 s", blocked=(6000, 1800)),
+    "pairs-4": Scenario("4 pairs with different seeds in the same room", pairs=4),
+    "pairs-10": Scenario("10 pairs with different seeds in the same room", pairs=10),
+    "pairs-30": Scenario("30 pairs with different seeds in the same room", pairs=30),
+    "event": Scenario("10 pairs next to a busy Wi-Fi access point on channel 13", pairs=10, wifi=((13, 0.5),)),
+}
+
+
+class Settings:
+    def __init__(self, args):
+        self.frame_rate = args.frame_rate
+        self.frame_micros = 1000000 // args.frame_rate
+        self.channels = args.channels
+        self.frames_per_hop = args.frames_per_hop
+        self.lower = args.lower
+        self.upper = args.upper
+        self.payload = args.payload
+        self.master_packets = args.master_packets
+        self.slave_packets = args.slave_packets
+        self.data_rate = args.data_rate
+        self.failed_before_scanning = args.frame_rate // 4 if args.frame_rate > 200 else 50
+        self.coast_micros = args.coast_ms * 1000
+        self.seconds = args.seconds
+        self.slot = TX_SETTLE_MICROS + packet_airtime(self.payload, self.data_rate)
+        self.airtime = packet_airtime(self.payload, self.data_rate)
+        # The Slave reads the Master's burst out before its fill callback and reply, ReplyBurstMicros in RadioCommon.h
+        self.reply_start = (SPI_LOAD_MICROS + self.slot * self.master_packets + SPI_LOAD_MICROS + TX_SETTLE_MICROS + REPLY_GUARD_MICROS
+                            + SPI_LOAD_MICROS * self.master_packets)
+        self.reply_slot = SPI_LOAD_MICROS + TX_SETTLE_MICROS + self.airtime
+        self.spread = 1 if self.data_rate < 2000 else 2  # MHz either side another packet still collides
+        self.hopping = args.hopping
+        self.start = args.start
+
+
+def make_links(scenario, settings, rng):
+    """Every pair gets its own addresses. Hop tables follow --hopping:
+    seed      GenerateChannels with a random seed per pair
+    same-seed GenerateChannels(lower, upper, 12345) on every pair, as in the examples
+    address   GenerateOrthogonalChannels from the pair's addresses
+    numbered  GenerateOrthogonalChannels with pair numbers 0, 1, 2...
+    --start together: every Master switched on at the same moment, all on hop 0 with their frames lined up
+    --start phase: the same but each Master called RandomiseFramePhase, so only the hops line up
+    --start independent: switched on at different times"""
+    s = settings
+    links = []
+    for i in range(scenario.pairs):
+        distance = scenario.distance if i == 0 else rng.uniform(1.0, 10.0)
+        if s.hopping == "seed":
+            table, channels = make_hop_table(s.lower, s.upper, rng.getrandbits(32)), s.channels
+        elif s.hopping == "same-seed":
+            table, channels = make_hop_table(s.lower, s.upper, 12345), s.channels
+        else:
+            pair_number = i if s.hopping == "numbered" else hop_address_hash(rng.randbytes(5), rng.randbytes(5))
+            table, channels = make_orthogonal_hop_table(s.lower, s.upper, pair_number), orthogonal_hop_length(s.lower, s.upper)
+        if s.start == "together":
+            phase, start_index = rng.randrange(50), 0
+        elif s.start == "phase":
+            phase, start_index = rng.randrange(s.frame_micros), 0
+        else:
+            phase, start_index = rng.randrange(s.frame_micros), rng.randrange(channels)
+        links.append(Link(i, s, rng, table, channels, distance, phase, start_index))
+    return links
+
+
+def run(scenario, settings, run_seed=1):
+    """Returns the links after the run, each with its own delivery counts and lock times."""
+    rng = random.Random(run_seed)
+    links = make_links(scenario, settings, rng)
+    frames = settings.seconds * settings.frame_rate
+    s = settings
+
+    # Master bursts never depend on anything heard, so they are all placed up front
+    bursts = []
+    for link in links:
+        for frame in range(frames):
+            start = link.phase + frame * s.frame_micros
+            channel = link.table[link.master_channel_index(frame)]
+            for p in range(s.master_packets):
+                packet_start = start + SPI_LOAD_MICROS + p * s.slot
+                bursts.append((packet_start, packet_start + s.airtime, channel, link.index, frame))
+    bursts.sort()
+
+    # Slave replies are decided in time order, once the Slave has heard (or missed) that frame's burst
+    replies = []
+    decisions = sorted((link.phase + frame * s.frame_micros, link.index, frame) for link in links for frame in range(frames))
+
+    def collides(start, end, channel, owner, transmissions):
+        for other_start, other_end, other_channel, other_owner, _ in transmissions:
+            if other_owner != owner and abs(other_channel - channel) <= s.spread and other_start < end and start < other_end:
+                return True
+        return False
+
+    def nearby(transmissions, start, end):
+        # Both lists are kept sorted by start time and no packet is longer than a frame
+        lo, hi = 0, len(transmissions)
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if transmissions[mid][0] < start - s.frame_micros:
+                lo = mid + 1
+            else:
+                hi = mid
+        window = []
+        for item in transmissions[lo:]:
+            if item[0] >= end:
+                break
+            window.append(item)
+        return window
+
+    def lost(start, end, channel, owner, distance, radios=1):
+        if rng.random() < scenario.interference_loss(channel):
+            return True
+        if all(rng.random() < scenario.path_loss(s, distance, rng) for _ in range(radios)):
+            return True
+        return collides(start, end, channel, owner, nearby(bursts, start, end)) or collides(start, end, channel, owner, nearby(replies, start, end))
+
+    for frame_start, index, frame in decisions:
+        link = links[index]
+        channel = link.table[link.master_channel_index(frame)]
+        listening = link.table[link.slave_index]
+        heard = False
+        locked = link.state == FULL_LOCK
+        if locked:
+            link.locked_frames += 1
+        if listening == channel and not scenario.is_blocked(frame_start):
+            for p in range(s.master_packets):
+                packet_start = frame_start + SPI_LOAD_MICROS + p * s.slot
+                if not lost(packet_start, packet_start + s.airtime, channel, index, link.distance, scenario.radios):
+                    link.slave_delivered += 1
+                    link.locked_delivered += 1 if locked else 0
+                    heard = True
+        link.update(frame, frame_start + s.frame_micros, heard)
+        if locked and listening == channel:
+            # The Slave replies on the channel it heard the burst on, straight after the Master's burst
+            for p in range(s.slave_packets):
+                reply_start = frame_start + s.reply_start + p * s.reply_slot + SPI_LOAD_MICROS + TX_SETTLE_MICROS
+                bisect.insort(replies, (reply_start, reply_start + s.airtime, channel, index, frame))
+
+    # The Master doesn't react to what it hears, so its reception is worked out once every reply is known
+    for start, end, channel, index, frame in replies:
+        if not lost(start, end, channel, index, links[index].distance):
+            links[index].master_delivered += 1
+    return links
+
+
+def report(name, scenario, links, settings):
+    seconds = settings.seconds
+    first_locks = [link.first_lock for link in links if link.first_lock is not None]
+    recoveries = [r for link in links for r in link.recoveries]
+    never = sum(1 for link in links if link.first_lock is None)
+    print("%-16s %9.1f %9.1f %10s %6d %10s %6d  %s" % (
+        name,
+        sum(link.slave_delivered for link in links) / seconds / len(links),
+        sum(link.master_delivered for link in links) / seconds / len(links),
+        "%.0f" % (sum(first_locks) / len(first_locks) / 1000) if first_locks else "-",
+        len(recoveries),
+        "%.0f" % (sum(recoveries) / len(recoveries) / 1000) if recoveries else "-",
+        never,
+        scenario.description))
+
+
+def header():
+    print("%-16s %9s %9s %10s %6s %10s %6s" % ("scenario", "M->S /s", "S->M /s", "lock ms", "drops", "recover ms", "unlock"))
+
+
+def add_link_arguments(parser):
+    parser.add_argument("--seconds", type=int, default=10)
+    parser.add_argument("--frame-rate", type=int, default=50)
+    parser.add_argument("--channels", type=int, default=40, help="channelsToHop")
+    parser.add_argument("--frames-per-hop", type=int, default=2)
+    parser.add_argument("--lower", type=int, default=76)
+    parser.add_argument("--upper", type=int, default=124)
+    parser.add_argument("--payload", type=int, default=32)
+    parser.add_argument("--master-packets", type=int, default=2)
+    parser.add_argument("--slave-packets", type=int, default=2)
+    parser.add_argument("--data-rate", type=int, default=1000, choices=(250, 1000, 2000), help="kbps")
+    parser.add_argument("--coast-ms", type=int, default=0, help="SetCoastTime, off by default as on the Slave")
+    parser.add_argument("--run-seed", type=int, default=1, help="same seed gives the same run")
+    parser.add_argument("--hopping", default="seed", choices=("seed", "same-seed", "address", "numbered"), help="how each pair's hop table is made")
+    parser.add_argument("--start", default="independent", choices=("independent", "phase", "together"), help="how the Masters were switched on")
+
+
+class LinkQualityCounter:
+    def __init__(self):
+        self.received = self.strong = self.expected = self.frames = 0
+        self.report = [0, 0, 0]
+
+    def add_packet(self, is_strong):
+        self.received += 1
+        self.strong += 1 if is_strong else 0
+
+    def end_frame(self, expected_packets):
+        self.expected += expected_packets
+        self.frames += 1
+        if self.frames < POWER_WINDOW_FRAMES:
+            return
+        self.report = [(self.report[0] + 1) & 0xFF,
+                       self.received * 100 // self.expected if self.expected else 0,
+                       self.strong * 100 // self.received if self.received else 0]
+        self.received = self.strong = self.expected = self.frames = 0
+
+
+class PowerController:
+    def __init__(self, max_level, target_percent):
+        self.max_level = max_level
+        self.target = target_percent
+        self.level = max_level
+        self.last_report = 0
+        self.peer_delivery = 0
+        self.has_report = False
+        self.settle = self.strong_reports = self.clean_reports = self.frames_since_report = self.windows_since_report = 0
+        self.probe_reports = POWER_PROBE_WINDOWS
+        self.is_probe = False
+        self.changes = 0
+
+    def set_level(self, level):
+        if level == self.level:
+            return False
+        self.level = level
+        self.settle = POWER_SETTLE_WINDOWS
+        self.strong_reports = self.clean_reports = 0
+        self.changes += 1
+        return True
+
+    def on_report(self, report):
+        if self.has_report and report[0] == self.last_report:
+            return False
+        is_first = not self.has_report
+        self.has_report = True
+        self.last_report = report[0]
+        self.peer_delivery = report[1]
+        self.windows_since_report = 0
+        if is_first:
+            return False
+        if self.settle > 0:
+            self.settle -= 1
+            return False
+        if report[1] < self.target:
+            if self.is_probe and self.probe_reports < POWER_PROBE_MAX_WINDOWS:
+                self.probe_reports *= 2
+            self.is_probe = False
+            return self.set_level(self.level + 1) if self.level < self.max_level else False
+        self.strong_reports = self.strong_reports + 1 if report[2] >= POWER_STRONG_PERCENT else 0
+        self.clean_reports = self.clean_reports + 1 if report[1] >= 100 else 0
+        if self.level == 0:
+            return False
+        if self.strong_reports >= POWER_STEP_DOWN_WINDOWS:
+            self.is_probe = False
+            return self.set_level(self.level - 1)
+        if self.clean_reports >= self.probe_reports:
+            self.is_probe = True
+            return self.set_level(self.level - 1)
+        return False
+
+    def end_frame(self):
+        self.frames_since_report += 1
+        if self.frames_since_report < POWER_WINDOW_FRAMES:
+            return False
+        self.frames_since_report = 0
+        self.windows_since_report += 1
+        if self.windows_since_report < POWER_REPORT_TIMEOUT_WINDOWS:
+            return False
+        self.windows_since_report = 0
+        self.has_report = False
+        return self.set_level(self.max_level)
+
+
+def run_power(settings, distance_at, controlled, run_seed=1, log=None):
+    """One pair on a clear band, distance_at(frame) in metres.  Each side sends its quality report in PACKET1 and
+    the other steps its PA level from it, or both stay at full power.  The Slave only replies while it has heard
+    the Master recently.  Returns the Master and Slave, each with what it received and its average TX current."""
+    s = settings
+    rng = random.Random(run_seed)
+    frames = s.seconds * s.frame_rate
+    master, slave = [{"name": name, "quality": LinkQualityCounter(), "power": PowerController(3, POWER_DEFAULT_TARGET),
+                      "received": 0, "milliamps": 0.0, "bursts": 0} for name in ("Master", "Slave")]
+    since_heard = s.failed_before_scanning
+
+    def send(sender, receiver, packets, frame, distance):
+        level = sender["power"].level if controlled else 3
+        sender["milliamps"] += TX_MILLIAMPS[level]
+        sender["bursts"] += 1
+        heard = False
+        for p in range(packets):
+            received = received_dbm(level, distance, rng)
+            if rng.random() < range_loss(s, received):
+                continue
+            heard = True
+            receiver["received"] += 1
+            receiver["quality"].add_packet(received > RPD_THRESHOLD_DBM)
+            if p == 0 and receiver["power"].on_report(sender["quality"].report) and log:
+                log(frame, receiver)
+        return heard
+
+    for frame in range(frames):
+        distance = distance_at(frame)
+        since_heard = 0 if send(master, slave, s.master_packets, frame, distance) else since_heard + 1
+        if since_heard < s.failed_before_scanning:
+            send(slave, master, s.slave_packets, frame, distance)
+        for side, expected in ((master, s.slave_packets), (slave, s.master_packets)):
+            side["quality"].end_frame(expected)
+            if side["power"].end_frame() and log:
+                log(frame, side)
+    for side in (master, slave):
+        side["milliamps"] /= max(side["bursts"], 1)
+    return master, slave
+
+
+def power_sweep(settings, args):
+    """Delivery and TX current with power control against fixed full power, from close up to the edge of range."""
+    frames = settings.seconds * settings.frame_rate
+    cases = [("%g m" % d, (lambda d: lambda frame: d)(d)) for d in (1, 3, 10, 20, 30, 40)]
+    cases.append(("walk 1-40 m", lambda frame: 1.0 + 39.0 * frame / frames))
+    print("Power control, %d fps, %d s per run.  Packets per second each way and average TX mA of the sender" % (settings.frame_rate, settings.seconds))
+    print("%-12s %23s %23s %8s" % ("distance", "full power M->S  S->M", "controlled M->S  S->M", "changes"))
+    for name, distance_at in cases:
+        log = None
+        if args.power_log:
+            def log(frame, side, name=name):
+                print("  %-12s frame %5d  %-6s level %d, peer delivery %d%%" % (name, frame, side["name"], side["power"].level, side["power"].peer_delivery))
+        fixed = run_power(settings, distance_at, False, args.run_seed)
+        master, slave = run_power(settings, distance_at, True, args.run_seed, log)
+        print("%-12s %5.0f %4.1fmA %5.0f %4.1fmA %5.0f %4.1fmA %5.0f %4.1fmA %8d" % (
+            name, fixed[1]["received"] / settings.seconds, fixed[0]["milliamps"], fixed[0]["received"] / settings.seconds, fixed[1]["milliamps"],
+            slave["received"] / settings.seconds, master["milliamps"], master["received"] / settings.seconds, slave["milliamps"],
+            master["power"].changes + slave["power"].changes))
+
+
+def coast_sweep(settings, args):
+    """Lock recovery time after the Master is shadowed, for several SetCoastTime values."""
+    coast_times = (0, 250, 500, 1000, 2000)
+    names = ("blocked-1200ms", "blocked-1800ms")
+    print("Average recovery ms from losing lock to full lock, %d fps, %d s per run" % (settings.frame_rate, settings.seconds))
+    print("%-16s" % "coast ms" + "".join("%10d" % coast for coast in coast_times))
+    for name in names:
+        row = "%-16s" % name
+        for coast in coast_times:
+            settings.coast_micros = coast * 1000
+            recoveries = [r for link in run(SCENARIOS[name], settings, args.run_seed) for r in link.recoveries]
+            row += "%10s" % ("%.0f" % (sum(recoveries) / len(recoveries) / 1000) if recoveries else "-")
+        print(row)
+
+
+def hop_sweep(settings, args):
+    """First lock and loss under narrowband interference for several SetHopping lengths and dwells, seeded
+    against orthogonal tables."""
+    configs = (
+        ("8 ch, 2 frames", 8, 2, "seed", 76, 124),
+        ("40 ch, 2 frames", 40, 2, "seed", 76, 124),
+        ("40 ch, 1 frame", 40, 1, "seed", 76, 124),
+        ("126 ch, 1 frame", 126, 1, "seed", 0, 124),
+        ("ortho 47, 2 frames", 47, 2, "address", 76, 124),
+        ("ortho 113, 1 frame", 113, 1, "address", 0, 124),
+    )
+    names = ("jammer", "wideband-jammer", "wifi-busy")
+    seeds = range(args.run_seed, args.run_seed + 20)
+    print("%d fps, %d s per run, averaged over %d run seeds.  Loss %% is with the Slave locked" % (settings.frame_rate, settings.seconds, len(seeds)))
+    print("%-20s %9s %9s" % ("hopping", "lock ms", "worst") + "".join("%17s" % name for name in names))
+    for label, channels, frames_per_hop, hopping, lower, upper in configs:
+        settings.channels, settings.frames_per_hop, settings.hopping = channels, frames_per_hop, hopping
+        settings.lower, settings.upper = lower, upper
+        locks = [link.first_lock for seed in seeds for link in run(SCENARIOS["clear"], settings, seed) if link.first_lock is not None]
+        row = "%-20s %9.0f %9.0f" % (label, sum(locks) / len(locks) / 1000, max(locks) / 1000)
+        for name in names:
+            links = [link for seed in seeds for link in run(SCENARIOS[name], settings, seed)]
+            sent = sum(link.locked_frames for link in links) * settings.master_packets
+            delivered = sum(link.locked_delivered for link in links)
+            row += "%17s" % ("%.1f" % (100.0 * (sent - delivered) / sent) if sent else "-")
+        print(row)
+
+
+def pairs_sweep(settings, args):
+    """Packet loss Master to Slave as more pairs share the band, for each way of making the hop tables."""
+    modes = ("same-seed", "seed", "address", "numbered")
+    print("Loss %% with the Slave locked, %d fps, %d s per run, Masters started %s" % (settings.frame_rate, settings.seconds, settings.start))
+    print("%5s" % "pairs" + "".join("%12s" % mode for mode in modes))
+    for pairs in (1, 2, 5, 10, 15, 20, 25, 30):
+        row = "%5d" % pairs
+        for mode in modes:
+            settings.hopping = mode
+            links = run(Scenario("", pairs=pairs), settings, args.run_seed)
+            sent = sum(link.locked_frames for link in links) * settings.master_packets
+            delivered = sum(link.locked_delivered for link in links)
+            row += "%12s" % ("%.1f" % (100.0 * (sent - delivered) / sent) if sent else "-")
+        print(row)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("scenarios", nargs="*", help="scenario names, all of them if left out")
+    parser.add_argument("--list", action="store_true", help="list the scenarios")
+    parser.add_argument("--pairs-sweep", action="store_true", help="loss against the number of pairs for each hopping mode")
+    parser.add_argument("--coast-sweep", action="store_true", help="lock recovery time against SetCoastTime")
+    parser.add_argument("--hop-sweep", action="store_true", help="lock time and interference loss for several hop lengths and dwells")
+    parser.add_argument("--power-sweep", action="store_true", help="power control against full power over distance")
+    parser.add_argument("--power-log", action="store_true", help="with --power-sweep, print every PA level change")
+    add_link_arguments(parser)
+    args = parser.parse_args()
+
+    if args.list:
+        for name, scenario in SCENARIOS.items():
+            print("%-16s %s" % (name, scenario.description))
+        raise SystemExit(0)
+
+    settings = Settings(args)
+    if args.pairs_sweep:
+        pairs_sweep(settings, args)
+        raise SystemExit(0)
+    if args.coast_sweep:
+        coast_sweep(settings, args)
+        raise SystemExit(0)
+    if args.hop_sweep:
+        hop_sweep(settings, args)
+        raise SystemExit(0)
+    if args.power_sweep:
+        power_sweep(settings, args)
+        raise SystemExit(0)
+
+    header()
+    for name in args.scenarios or SCENARIOS:
+        if name not in SCENARIOS:
+            raise SystemExit("Unknown scenario %s, see --list" % name)
+        report(name, SCENARIOS[name], run(SCENARIOS[name], settings, args.run_seed), settings)
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Measure how small the low power Slave's listen window can be with the drift tracker holding it in step.
+
+Models the Slave's frame clock the way AdvanceFrame in RadioSlave.cpp does: every frame a burst is heard the IRQ
+time stamp pulls the next frame end onto it and nudges microsPerFrame by 1 us, frames without one just add
+microsPerFrame.  The Master's frames are a little longer or shorter than ours by the crystals' ppm difference, IRQ
+time stamps carry interrupt latency, and bursts are lost at random.  For every frame spent in full lock it records
+how early the Master's burst came compared to where the Slave expected it, which is what EnableLowPower's guard has
+to cover, then runs again with the guard in place so bursts missed by listening too late also cost their sync.
+
+Run: rx_window.py                     the default ppm and loss grid
+     rx_window.py --guard 50 --ppm 100 --loss 0.3
+"""
+
+import argparse
+import math
+import random
+
+from hop_scenarios import packet_airtime, SPI_LOAD_MICROS, TX_SETTLE_MICROS, REPLY_GUARD_MICROS
+
+LOWPOWER_DEFAULT_GUARD_MICROS = 200
+
+
+class Settings:
+    def __init__(self, args):
+        self.frame_rate = args.frame_rate
+        self.frame_micros = 1000000 // args.frame_rate
+        self.payload = args.payload
+        self.master_packets = args.master_packets
+        self.slave_packets = args.slave_packets
+        self.data_rate = args.data_rate
+        self.failed_before_scanning = args.frame_rate // 4 if args.frame_rate > 200 else 50
+        self.seconds = args.seconds
+        self.jitter = args.jitter
+        self.tail = args.tail
+        self.airtime = packet_airtime(self.payload, self.data_rate)
+        # ReplyDelayMicros and ReplyBurstMicros in RadioCommon.h
+        slot = TX_SETTLE_MICROS + self.airtime
+        self.sync_delay = (self.master_packets - 1) * slot + SPI_LOAD_MICROS + TX_SETTLE_MICROS + REPLY_GUARD_MICROS
+        self.reply_burst = (self.master_packets + 1) * SPI_LOAD_MICROS + self.slave_packets * (SPI_LOAD_MICROS + TX_SETTLE_MICROS + self.airtime)
+
+    def radio_on_micros(self, guard):
+        """Listen lead from WaitForListenWindow, then reading the burst out and our reply."""
+        lead = self.sync_delay + self.airtime + TX_SETTLE_MICROS + guard
+        return lead + self.reply_burst
+
+
+def truncate_mod(value, modulus):
+    """C's % on int32, the sign follows the dividend."""
+    return int(math.fmod(value, modulus))
+
+
+def run(settings, ppm, loss, guard=None, run_seed=1):
+    """Returns how early each burst arrived against the Slave's prediction, in us, for frames in full lock,
+    plus bursts missed because the window opened too late and times lock was lost."""
+    s = settings
+    rng = random.Random(run_seed)
+    master_frame = s.frame_micros * (1.0 + ppm / 1e6)
+    micros_per_frame = s.frame_micros
+    half_frame = micros_per_frame // 2
+
+    def irq_latency():
+        latency = abs(rng.gauss(0, s.jitter))
+        if rng.random() < s.tail:
+            latency += rng.uniform(0, 20)  # Flash cache misses and other interrupts
+        return latency
+
+    # Locked on the first burst
+    frame_end = round(irq_latency()) + s.sync_delay
+    failed = 0
+    early = []
+    missed_by_window = 0
+    unlocks = 0
+    for frame in range(1, s.seconds * s.frame_rate):
+        irq = frame * master_frame  # Master's first packet ending, before our interrupt latency
+        next_end = frame_end + micros_per_frame  # AdvanceFrame runs at frame_end, this frame's burst lands before the next
+        error = irq - (next_end - s.sync_delay)
+        early.append(-error)
+        heard = rng.random() >= loss
+        if heard and guard is not None and -error > guard:
+            heard = False
+            missed_by_window += 1
+
+        if heard:
+            failed = 0
+            interrupt_time = irq + irq_latency() + s.sync_delay
+            drift = truncate_mod(round(interrupt_time - next_end), micros_per_frame)
+            if drift > half_frame:
+                drift -= micros_per_frame
+            elif drift < -half_frame:
+                drift += micros_per_frame
+            frame_end = next_end + drift
+            micros_per_frame += -1 if drift < 0 else 1
+        else:
+            failed += 1
+            frame_end = next_end
+            if failed >= s.failed_before_scanning:
+                # Scanning finds the Master again, the frame time it learned is kept
+                unlocks += 1
+                failed = 0
+                frame_end = round(irq + irq_latency()) + s.sync_delay - micros_per_frame
+    return early, missed_by_window, unlocks
+
+
+def percentile(values, percent):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * percent / 100.0))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--seconds", type=int, default=60)
+    parser.add_argument("--frame-rate", type=int, default=50)
+    parser.add_argument("--payload", type=int, default=32)
+    parser.add_argument("--master-packets", type=int, default=2)
+    parser.add_argument("--slave-packets", type=int, default=2)
+    parser.add_argument("--data-rate", type=int, default=1000, choices=(250, 1000, 2000), help="kbps")
+    parser.add_argument("--jitter", type=float, default=2.0, help="IRQ time stamp latency spread, us")
+    parser.add_argument("--tail", type=float, default=0.01, help="share of IRQs delayed up to 20 us more")
+    parser.add_argument("--ppm", type=float, nargs="*", default=(0, 20, 50, 100), help="Master's crystal against ours")
+    parser.add_argument("--loss", type=float, nargs="*", default=(0.0, 0.1, 0.5), help="share of bursts lost")
+    parser.add_argument("--guard", type=int, default=LOWPOWER_DEFAULT_GUARD_MICROS, help="EnableLowPower guard to try, us")
+    parser.add_argument("--run-seed", type=int, default=1, help="same seed gives the same run")
+    args = parser.parse_args()
+    s = Settings(args)
+
+    print("%d fps, %d s per run.  How early the Master's burst came against the Slave's prediction, us" % (s.frame_rate, s.seconds))
+    print("%6s %6s %8s %8s %8s %10s  %s" % ("ppm", "loss", "p99", "p99.9", "max", "guard >=", "with a %d us guard" % args.guard))
+    for ppm in args.ppm:
+        for loss in args.loss:
+            early, _, _ = run(s, ppm, loss, None, args.run_seed)
+            _, missed, unlocks = run(s, ppm, loss, args.guard, args.run_seed)
+            print("%6g %6g %8.1f %8.1f %8.1f %10d  %d bursts missed by the window, %d unlocks" % (
+                ppm, loss, percentile(early, 99), percentile(early, 99.9), max(early), math.ceil(max(max(early), 0)), missed, unlocks))
+
+    print()
+    print("Radio on per frame with a %d us guard: %d us of %d us, %.1f%%" % (
+        args.guard, s.radio_on_micros(args.guard), s.frame_micros, 100.0 * s.radio_on_micros(args.guard) / s.frame_micros))
+
+
+if __name__ == "__main__":
+    main()